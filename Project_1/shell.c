@@ -1,39 +1,334 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sched.h>
+#include <ctype.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
 #include <sys/wait.h>
 #include <signal.h>
-#include <pthread.h>
 #include <libgen.h>
 
-#define NUM_BACKGROUND 10
+#define JOB_BUCKETS 16 // Starting number of buckets in the job table, doubled as it fills
+#define FINISHED_JOBS 32 // Number of finished processes jobs remembers in timing mode
+#define MAX_LIMITS 16 // Most rlimit settings on one line
+#define PATH_BUCKETS 256
+#define ARENA_BLOCK 65536 // Smallest block the line arena allocates
+#define PUMP_CHUNK 65536 // Bytes copied at a time between files by the shell, the size of a pipe
+#define INPUT_CHUNK 4096 // Smallest read of command input, and the first size of the input buffer
+#define CAPTURE_POOL 4 // Number of command substitution buffers kept for reuse
+#define CAPTURE_KEEP (1 << 20) // Largest command substitution buffer kept for reuse, bigger ones are shrunk back
+#define SESSION_MAGIC "308SESS1" // First bytes of a session file
+#define SESSION_GROW 65536 // Smallest size of a session file, doubled as it fills
+
+// Types of session file records
+#define SESSION_HISTORY 1 // a line read from the user
+#define SESSION_PATH 2 // where a command was found on PATH, or that it should be forgotten
+#define SESSION_CLEAR 3 // every command location was forgotten
+
+// Ways to start a program command
+#define LAUNCH_SPAWN 0 // posix_spawnp, which reports exec failures itself
+#define LAUNCH_VFORK 1 // vfork then execvp, borrowing the shell's memory until the exec
+#define LAUNCH_FORK 2 // fork then execvp, copying the shell's page tables
 
 // Declare global variables
-pthread_mutex_t  mut;
-pthread_cond_t child_cv;
-int numBgProcesses = 0;
+extern char **environ;
+int launchMode = LAUNCH_SPAWN;
+int maxParallel = 1; // Holds the most program commands run at once, 1 to wait for each one
+int timingMode = 0; // 1 to print the resource usage of every process and keep finished ones for jobs
+int inputFd = 0; // Holds where commands are read from - fd 0, or the -f script
+char* inputBuf; // Holds input read from inputFd, from the start of the next line on
+size_t inputPos = 0, inputLen = 0, inputCap = 0; // Where the next line starts, the bytes read and the buffer size
+int inputEnded = 0; // 1 once inputFd has reached its end or failed
+int childFd; // signalfd that becomes readable when a child exits - SIGCHLD is blocked and read from here
+int quietJobs = 0; // 1 in a command substitution subshell, so process messages are not captured with the output
+sigset_t childMask; // Holds only SIGCHLD
+
+// Defines a block of the line arena
+typedef struct arenaBlock {
+    struct arenaBlock* next; // The next block, used once this one is full
+    size_t size, used; // Bytes in the block and bytes handed out
+    char data[]; // The memory handed out
+} arenaBlock;
+
+// Holds the memory for the current line
+//  - Everything a line needs is carved out of these blocks and given back all at once before the next line
+//  - Blocks are kept for the next line, so once they are big enough, running a line does no malloc or free
+arenaBlock* arenaFirst = NULL, * arenaCurrent = NULL;
+
+// Defines the words of a line
+typedef struct tokenList {
+    char** words; // The NULL terminated words, in the line arena
+    int count; // Number of words
+} tokenList;
+
+// Defines a buffer the output of a command substitution is read into
+//  - The memory is an anonymous mapping, grown with mremap so large outputs are not copied on every doubling
+typedef struct captureBuffer {
+    char* data; // The output read so far
+    size_t size, used; // Bytes mapped and bytes read
+} captureBuffer;
+
+// Holds the command substitution buffers not in use, so running one again does not map new memory
+captureBuffer* capturePool[CAPTURE_POOL];
+int numPooled = 0;
+
+// Returned by a builtin that leaves the line to the program of the same name, for something only the program handles
+#define RUN_PROGRAM -1
+
+// Launch settings in the order applySettings applies them, so the child can report which one failed
+#define SETTING_CPUS 1
+#define SETTING_NICE 2
+#define SETTING_IONICE 3
+#define SETTING_RLIMIT 4
+char* settingNames[] = {NULL, "cpus", "nice", "ionice", "rlimit"};
+
+// Holds the operator words - the tokenizer points unquoted operators here, so a quoted "|" is not mistaken for one
+char* operators[] = {"|", "<", ">", ">>", "&"};
+
+// Defines the settings a line's processes are started with, from the words before the command
+//  - cpus=<list> : Run only on these CPUs, like 0,2-3
+//  - nice=<n> : Run at this niceness
+//  - ionice=<class>[:<level>] : Run at this IO priority - class is rt, be or idle, level is 0 to 7
+//  - rlimit=<resource>:<value> : Limit a resource, like as:512M or nofile:64 - value can be unlimited
+typedef struct launchSettings {
+    int failed; // Set by launchCmd to the SETTING_* the child could not apply, 0 if none
+    char* text; // The settings as they were typed, NULL for none
+    int hasCpus; // 1 if cpus was given
+    cpu_set_t cpus; // The CPUs to run on
+    int hasNice; // 1 if nice was given
+    int nice; // The niceness
+    int ioPriority; // The IO priority as passed to ioprio_set, 0 if ionice was not given
+    int numLimits; // Number of rlimit settings
+    int resources[MAX_LIMITS]; // The resource of each rlimit setting
+    struct rlimit limits[MAX_LIMITS]; // The limit of each rlimit setting
+} launchSettings;
 
 // Defines a background process
 typedef struct bgProcess {
     char* cmd; // The name of the cmd that was run
     int PID; // The PID of the background process
+    int parallel; // 1 if this is a command run by the parallel scheduler instead of with &
+    char* settings; // The launch settings it was started with, NULL for none
+    struct timespec start; // When the process started
+    struct bgProcess* next; // The next process in the same bucket
+    struct bgProcess* prevJob, * nextJob; // The processes started just before and after this one
 } bgProcess;
 
+// Defines a process that finished, kept for jobs in timing mode
+typedef struct finishedProcess {
+    char* cmd; // The name of the cmd that was run
+    int PID; // The PID of the process
+    int status; // The exit status of the process
+    double wallTime; // Seconds the process ran for
+    struct rusage usage; // The resources the process used
+} finishedProcess;
+
+// Defines the table of background processes
+//  - Processes are hashed by PID so adding, finding and removing one takes constant time
+//  - Processes are also linked in the order they started, which jobs prints them in
+typedef struct jobTable {
+    bgProcess** buckets; // Lists of processes by PID
+    int numBuckets; // Number of buckets, always a power of two
+    int numJobs; // Number of background processes
+    int numParallel; // Number of those run by the parallel scheduler
+    bgProcess* first, * last; // The oldest and newest processes
+    finishedProcess finished[FINISHED_JOBS]; // The last processes that finished in timing mode, oldest overwritten first
+    int numFinished; // Number of processes that ever finished in timing mode
+} jobTable;
+
+// Defines a remembered location of a command found on PATH
+typedef struct pathEntry {
+    char* name; // The name of the command
+    char* path; // The full path the command was found at
+    int hits; // The number of times the location was used
+    struct pathEntry* next; // The next entry in the same bucket
+} pathEntry;
+
+// Defines the start of a session file
+typedef struct sessionHeader {
+    char magic[8]; // SESSION_MAGIC
+    unsigned long long used; // Bytes of the file holding records, this header included
+} sessionHeader;
+
+// Defines a record in a session file - records are only ever appended
+typedef struct sessionRecord {
+    unsigned int size; // Bytes in the record, this header included, a multiple of 8
+    unsigned int type; // One of the SESSION_* record types
+    unsigned int pathHash; // For a command location, hashName of the PATH it was found on
+    char text[]; // The line, or the command name then its path, each ending in a NUL - no path to forget it
+} sessionRecord;
+
+// Defines a history line in the prefix index
+typedef struct historyEntry {
+    size_t offset; // Where its record is in the session file - offsets stay valid when the file is mapped again
+    int number; // Its history number, the most recent if it was entered more than once
+} historyEntry;
+
+// Holds the session file, which keeps history and command locations between sessions
+//  - The file is mapped shared, so records appended by other shells show up in the map
+//  - Appends are done under flock, after catching up on the records other shells appended
+typedef struct sessionFile {
+    int fd; // The file, -1 for no session
+    char* map; // The mapped file
+    size_t mapSize; // Bytes mapped
+    size_t loaded; // Bytes of records this shell has read
+    int numHistory; // Number of history lines read
+    historyEntry* index; // Every distinct history line, sorted by text for prefix searches
+    int indexSize, indexCap; // Entries in the index and room for them
+    int sorted; // 0 while the file is being opened, when history lines are added unsorted and sorted at the end
+    int replaying; // 1 while records are being read, so what they do is not appended again
+} sessionFile;
+sessionFile session = {-1, NULL, 0, 0, 0, NULL, 0, 0, 0, 0};
+
+// Defines one command of a pipeline
+typedef struct stage {
+    char** args; // The NULL terminated arguments of the command
+    char* inFile; // The file named with <, NULL for none
+    int firstOut, numOut; // The range of the command's > and >> files in the output file list
+    int inFd; // The file the command reads from, 0 for the terminal
+    int fanFd; // The pipe the shell copies to every output file, -1 for none
+    int pid; // The PID of the process running the command, -1 if it could not be started
+} stage;
+
+// Defines a file named with > or >>
+typedef struct outFile {
+    char* name; // The name of the file
+    int flags; // The flags the file is opened with
+    int fd; // The opened file
+} outFile;
+
+// Holds the command locations found so far, keyed by command name
+pathEntry* pathTable[PATH_BUCKETS];
+// Holds the PATH the table was filled under - the table is cleared once PATH changes
+char* pathTablePath = NULL;
+
 // Declare functions
-int builtInCmds(char input[500], bgProcess bgProc[]);
-void programCmd(char input[500], bgProcess bgProc[]);
-void checkBgProcesses(bgProcess bgProc[]);
-void printStatus(int pid, int status, char* cmd);
-void removeBgProcess(bgProcess bgProc[], int idx);
+int builtInCmds(tokenList* line, jobTable* jobs);
+int compareBuiltins(const void* a, const void* b);
+int exitCmd(int argc, char* argv[], jobTable* jobs);
+int pidCmd(int argc, char* argv[], jobTable* jobs);
+int ppidCmd(int argc, char* argv[], jobTable* jobs);
+int cdCmd(int argc, char* argv[], jobTable* jobs);
+int pwdCmd(int argc, char* argv[], jobTable* jobs);
+int hashCmd(int argc, char* argv[], jobTable* jobs);
+int historyCmd(int argc, char* argv[], jobTable* jobs);
+int parallelCmd(int argc, char* argv[], jobTable* jobs);
+int timeCmd(int argc, char* argv[], jobTable* jobs);
+int timingCmd(int argc, char* argv[], jobTable* jobs);
+int waitCmd(int argc, char* argv[], jobTable* jobs);
+int jobsCmd(int argc, char* argv[], jobTable* jobs);
+int trueCmd(int argc, char* argv[], jobTable* jobs);
+int falseCmd(int argc, char* argv[], jobTable* jobs);
+int echoCmd(int argc, char* argv[], jobTable* jobs);
+int printfCmd(int argc, char* argv[], jobTable* jobs);
+int sleepCmd(int argc, char* argv[], jobTable* jobs);
+int testCmd(int argc, char* argv[], jobTable* jobs);
+int evalTest(int numArgs, char* args[]);
+int printText(char* text, int escapes);
+void programCmd(tokenList* line, jobTable* jobs, int timed);
+int tokenize(char* text, tokenList* line);
+void runLine(char* text, jobTable* jobs);
+char* expandLine(char* text, jobTable* jobs);
+char* findClose(char* ptr);
+char* reserveText(char* text, size_t used, size_t* cap, size_t more);
+int captureCmd(char* text, jobTable* jobs, captureBuffer* buf);
+int growCapture(captureBuffer* buf);
+captureBuffer* getCapture();
+void putCapture(captureBuffer* buf);
+void* arenaGrow(void* mem, size_t oldSize, size_t newSize);
+int isOperator(char* word);
+void* arenaAlloc(size_t size);
+void arenaReset();
+void checkBgProcesses(jobTable* jobs);
+void waitForInput(jobTable* jobs, char* userPrompt);
+void fillInput();
+char* readLine();
+void waitForSlots(jobTable* jobs, int slots);
+void printStatus(int pid, int status, char* cmd, double wallTime, struct rusage* usage);
+void reportProcess(jobTable* jobs, int pid, int status, char* cmd, struct timespec* start, int detail, struct rusage* usage);
+int readProcUsage(int pid, struct rusage* usage);
+double secondsSince(struct timespec* start);
+bgProcess* addBgProcess(jobTable* jobs, int pid, char* cmd, int parallel, char* settings);
+bgProcess* findBgProcess(jobTable* jobs, int pid);
+void removeBgProcess(jobTable* jobs, bgProcess* proc);
+int launchCmd(char* cmd, char* cmdArgs[], int inFd, int outFd, launchSettings* settings);
+int parseSetting(launchSettings* settings, char* word);
+int applySettings(launchSettings* settings);
+long long parseSize(char* value);
+void closeFiles(stage stages[], int numStages, outFile outFiles[], int numOutFiles);
+void pumpData(int inFd, int inIsPipe, int outFds[], int numOut);
+int moveData(int pipeFd, int outFd, ssize_t n);
+char* findCmd(char* cmd, int remember);
+void forgetCmd(char* cmd);
+void clearPathTable();
+unsigned int hashName(char* name);
+void seedCmd(char* cmd, char* path);
+void openSession(char* fileName);
+int mapSession();
+void catchUpSession();
+void applyRecord(sessionRecord* rec, size_t offset);
+void appendSession(int type, unsigned int pathHash, char* text, char* path);
+void indexHistory(size_t offset, int number);
+int compareHistory(const void* a, const void* b);
+char* historyText(size_t offset);
+
+// Defines a command run inside the shell instead of as a program
+typedef struct builtin {
+    char* name; // The name of the command
+    int (*run)(int argc, char* argv[], jobTable* jobs); // Runs the command and returns its exit status, or RUN_PROGRAM
+    int takesLine; // 1 if the command gets the whole line, |, <, > and & included
+    int blocks; // 1 if the command waits on its own, so the program of the same name runs instead when commands run in parallel
+} builtin;
+
+// Holds every builtin, sorted by name for bsearch
+builtin builtins[] = {
+    {"[", testCmd, 0, 0},
+    {"cd", cdCmd, 0, 0},
+    {"echo", echoCmd, 0, 0},
+    {"exit", exitCmd, 0, 0},
+    {"false", falseCmd, 0, 0},
+    {"hash", hashCmd, 0, 0},
+    {"history", historyCmd, 0, 0},
+    {"jobs", jobsCmd, 0, 0},
+    {"parallel", parallelCmd, 0, 0},
+    {"pid", pidCmd, 0, 0},
+    {"ppid", ppidCmd, 0, 0},
+    {"printf", printfCmd, 0, 0},
+    {"pwd", pwdCmd, 0, 0},
+    {"sleep", sleepCmd, 0, 1},
+    {"test", testCmd, 0, 0},
+    {"time", timeCmd, 1, 0},
+    {"timing", timingCmd, 0, 0},
+    {"true", trueCmd, 0, 0},
+    {"wait", waitCmd, 0, 0},
+};
 
 /* The main function for the UNIX-like shell
 * Switches:
 *   -p <prompt> : This becomes the user prompt - Default is "308sh> "
+*   -l <spawn|vfork|fork> : How program commands are started - Default is spawn
+*   -f <script> : Read commands from script instead of the user, without a prompt, and exit at its end
+*   -j <n> : Run up to n program commands at once, like the parallel builtin - Default is 1
+*   -t : Start in timing mode, like timing on
+*   -s <file> : Keep history and command locations in file, or in none if it is empty - Default is ~/.308sh_session
 */
 int main(int argc, char *argv[]) {
     // String to hold the user prompt
     char userPrompt[50] = "308sh> ";
+    char* sessionName = NULL;
 
     // Loop through all arguments passed in
     int i;
@@ -43,316 +338,2547 @@ int main(int argc, char *argv[]) {
             // Read the input to userPrompt
             strncpy(userPrompt, argv[++i], sizeof(userPrompt) - 1);
         }
+        // Check for the -l switch
+        if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "fork")) {
+                launchMode = LAUNCH_FORK;
+            } else if (!strcmp(argv[i], "vfork")) {
+                launchMode = LAUNCH_VFORK;
+            } else {
+                launchMode = LAUNCH_SPAWN;
+            }
+        }
+        // Check for the -f switch
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            inputFd = open(argv[++i], O_RDONLY | O_CLOEXEC);
+            if (inputFd < 0) {
+                printf("Cannot open %s: %s\n", argv[i], strerror(errno));
+                exit(1);
+            }
+            // Scripts get no prompt
+            userPrompt[0] = 0;
+        }
+        // Check for the -t switch
+        if (!strcmp(argv[i], "-t")) {
+            timingMode = 1;
+        }
+        // Check for the -j switch
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            maxParallel = atoi(argv[++i]);
+            if (maxParallel < 1) {
+                maxParallel = 1;
+            }
+        }
+        // Check for the -s switch
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            sessionName = argv[++i];
+        }
+    }
+
+    // Load the history and command locations of earlier sessions
+    char defaultSession[500];
+    if (sessionName == NULL && getenv("HOME") != NULL) {
+        snprintf(defaultSession, sizeof(defaultSession), "%s/.308sh_session", getenv("HOME"));
+        sessionName = defaultSession;
+    }
+    if (sessionName != NULL && strcmp(sessionName, "")) {
+        openSession(sessionName);
     }
 
-    // Define the struct to hold background processes
-    bgProcess bgProc[NUM_BACKGROUND];
+    // Holds the input, grown by fillInput to fit the longest line so far
+    inputCap = INPUT_CHUNK;
+    inputBuf = malloc(inputCap);
+    // Only a terminal has a user typing lines, so piped input and scripts stay out of the history
+    int recordHistory = isatty(inputFd);
 
-    // Initialize mutex & conditionals
-    pthread_mutex_init(&mut, NULL);
-    pthread_cond_init(&child_cv, NULL);
+    // Define the table to hold background processes
+    jobTable jobs = {.buckets = calloc(JOB_BUCKETS, sizeof(bgProcess*)), .numBuckets = JOB_BUCKETS};
+
+    // Block SIGCHLD and read it from childFd instead, so children are reaped as soon as they exit
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, NULL);
+    childFd = signalfd(-1, &childMask, SFD_NONBLOCK | SFD_CLOEXEC);
 
     // Run an infinite loop waiting for user input
     while(1) {
         // Call a helper to check for background processes
-        checkBgProcesses(bgProc);
+        checkBgProcesses(&jobs);
 
         // Print the command line
         printf("%s", userPrompt);
 
-        // Create a variable to handle input
-        char tempInput[500];
-        
-        // Read the user input -- error if fgets fails
-        if (fgets(tempInput, 500, stdin) == NULL) { exit(1); }
-        // Remove the extra newline characters
-        tempInput[strcspn(tempInput, "\n")] = 0;
-        // Remove whitespace at start
-        int i, j, regChar = 0;
-        char input[500];
-        for (i = 0, j = 0; i < strlen(tempInput); i++, j++) {
-            // Copy over all characters that are not whitespace until first non-whitespace char, then copy all
-            if (regChar || tempInput[i] != ' ') {
-                regChar = 1; // Set the flag to 1 to notify to copy the rest, including whitespaces
-                input[j] = tempInput[i];
-            } else {
-                j--;
-            }
-        }
-        input[j] = 0;
+        // Reap background processes that finish while waiting for input
+        waitForInput(&jobs, userPrompt);
 
-        // If the user input is empty, continue the loop
-        if (!strcmp(input, "")) {
-            continue;
+        // Take the user input, of any length -- at the end, let the parallel commands finish, then exit, with an error unless it was a script
+        char* inputLine = readLine();
+        if (inputLine == NULL) {
+            waitForSlots(&jobs, maxParallel);
+            exit(inputFd == 0);
         }
 
-        // Check for builtInCmds
-        // Return -- 0 if none ran; 1 if continue
-        if (builtInCmds(input, bgProc)) {
-            continue;
+        // Keep lines the user typed in the history
+        if (recordHistory && inputLine[strspn(inputLine, " \t")] != 0) {
+            appendSession(SESSION_HISTORY, 0, inputLine, NULL);
         }
 
-        // If execution makes it this far, it must be a program command
-        programCmd(input, bgProc);
+        // Run the line, giving back the last line's memory first
+        arenaReset();
+        runLine(inputLine, &jobs);
+    }
+}
+
+/* Runs one line of input
+*  - Command substitutions are run first and replaced by their output
+*
+* Inputs:
+*   text -- The line
+*   jobs -- The table that holds all background process information
+*/
+void runLine(char* text, jobTable* jobs) {
+    // Replace the command substitutions
+    if (strstr(text, "$(") != NULL && (text = expandLine(text, jobs)) == NULL) {
+        return;
+    }
+
+    // Split the input into words
+    tokenList line;
+    if (!tokenize(text, &line)) {
+        return;
+    }
+
+    // If the user input is empty, there is nothing to run
+    if (line.count == 0) {
+        return;
     }
+
+    // Check for builtInCmds
+    // Return -- 0 if none ran; 1 if one did
+    if (builtInCmds(&line, jobs)) {
+        return;
+    }
+
+    // If execution makes it this far, it must be a program command
+    programCmd(&line, jobs, 0);
 }
 
 /* Runs the all built in commands
+*  - The command is looked up by name in the builtins table
+*  - A line with |, <, >, >> or & goes to programCmd instead, so the program of the same name handles it, unless the builtin takes the whole line
+*  - With parallel commands on, a builtin that blocks goes to programCmd too, so it takes a slot instead of holding up the shell
+*  - A builtin that returns RUN_PROGRAM goes to programCmd as well
+*
 * Inputs:
-*   input -- Char array that is the user's inputted value
-*   bgProc -- The struct that holds all background process information
+*   line -- The words of the user's inputted value
+*   jobs -- The table that holds all background process information
 *
 * Outputs:
 *   int -- 0 if no commands ran; 1 if one command did run
 */
-int builtInCmds(char input[500], bgProcess bgProc[]) {
-    // If the user input is exit, break out of the loop
-    if (!strcmp(input, "exit")) {
-        exit(0);
+int builtInCmds(tokenList* line, jobTable* jobs) {
+    // Check for operators
+    int i, hasOperator = 0;
+    for (i = 0; i < line->count; i++) {
+        hasOperator |= isOperator(line->words[i]);
     }
 
-    // If the user input is pid, print the process ID
-    if (!strcmp(input, "pid")) {
-        printf("Process ID: %d\n", getpid());
-        return 1;
+    // Find the command
+    builtin key = {line->words[0], NULL, 0, 0};
+    builtin* found = bsearch(&key, builtins, sizeof(builtins) / sizeof(builtin), sizeof(builtin), compareBuiltins);
+    if (found == NULL || (hasOperator && !found->takesLine) || (found->blocks && maxParallel > 1)) {
+        return 0;
     }
 
-    // If the user input is ppid, print the parent's process ID
-    if (!strcmp(input, "ppid")) {
-        printf("Parent Process ID: %d\n", getppid());
-        return 1;
+    // Run it
+    return found->run(line->count, line->words, jobs) != RUN_PROGRAM;
+}
+
+/* Compares two builtins by name for bsearch
+* Inputs:
+*   a -- The first builtin
+*   b -- The second builtin
+*
+* Outputs:
+*   int -- Less than, equal to or greater than 0 as a's name sorts before, with or after b's
+*/
+int compareBuiltins(const void* a, const void* b) {
+    return strcmp(((builtin*) a)->name, ((builtin*) b)->name);
+}
+
+/* The builtins below share one signature
+* Inputs:
+*   argc -- The number of words, including the command name
+*   argv -- The NULL terminated words
+*   jobs -- The table that holds all background process information
+*
+* Outputs:
+*   int -- The exit status, 0 for success
+*/
+
+// exit [status] -- Exits the shell
+int exitCmd(int argc, char* argv[], jobTable* jobs) {
+    exit(argc > 1 ? atoi(argv[1]) : 0);
+}
+
+// pid -- Prints the process ID
+int pidCmd(int argc, char* argv[], jobTable* jobs) {
+    printf("Process ID: %d\n", getpid());
+    return 0;
+}
+
+// ppid -- Prints the parent's process ID
+int ppidCmd(int argc, char* argv[], jobTable* jobs) {
+    printf("Parent Process ID: %d\n", getppid());
+    return 0;
+}
+
+// cd [dir] -- Goes to dir, if valid, or to the home directory if there is none - quote a dir with spaces
+int cdCmd(int argc, char* argv[], jobTable* jobs) {
+    if (argc == 1) {
+        return chdir(getenv("HOME")) != 0;
     }
-    
-    // If the user input is cd & has no further arguments, go to home directory
-    // Else, if the user input is cd & has further arguments, go to that location, if valid
-    if (!strncmp(input, "cd", 2) && strlen(input) == 2) {
-        chdir(getenv("HOME"));
+    // CD to the specified directory -- if fails, tell the user
+    if (chdir(argv[1]) != 0) {
+        printf("cd: %s: No such file or directory\n", argv[1]);
         return 1;
-    } else if (!strncmp(input, "cd", 2)) {
-        char cdArgs[500] = "";
-        // Copy the argument
-        strncpy(cdArgs, input + 3, strlen(input) - 3);
-        // CD to the specified directory -- if fails, tell the user
-        if (chdir(cdArgs) != 0) {
-            printf("cd: %s: No such file or directory\n", cdArgs);
+    }
+    return 0;
+}
+
+// pwd -- Prints the current working directory
+int pwdCmd(int argc, char* argv[], jobTable* jobs) {
+    char cwd[500];
+    printf("%s\n", getcwd(cwd, sizeof(cwd)));
+    return 0;
+}
+
+// hash [-r | name...] -- Prints the remembered command locations, forgets them all, or looks up each name and remembers it
+int hashCmd(int argc, char* argv[], jobTable* jobs) {
+    int i, status = 0;
+    if (argc == 1) {
+        findCmd("", 0); // Clears the table if PATH changed
+        pathEntry* entry;
+        printf("hits\tcommand\n");
+        for (i = 0; i < PATH_BUCKETS; i++) {
+            for (entry = pathTable[i]; entry != NULL; entry = entry->next) {
+                printf("%4d\t%s\n", entry->hits, entry->path);
+            }
+        }
+    } else if (!strcmp(argv[1], "-r")) {
+        clearPathTable();
+        appendSession(SESSION_CLEAR, 0, "", NULL);
+    } else {
+        // Look up every name
+        for (i = 1; i < argc; i++) {
+            if (findCmd(argv[i], 0) == NULL) {
+                printf("hash: %s: not found\n", argv[i]);
+                status = 1;
+            }
         }
-        return 1;
     }
+    return status;
+}
 
-    // If the user input is pwd, print the current working directory
-    if (!strcmp(input, "pwd")) {
-        char cwd[500];
-        printf("%s\n", getcwd(cwd, sizeof(cwd)));
+// history [prefix] -- Prints every history line, or the distinct ones starting with prefix, oldest first
+int historyCmd(int argc, char* argv[], jobTable* jobs) {
+    if (session.fd < 0) {
+        printf("history: no session file\n");
         return 1;
     }
+    catchUpSession();
+    if (argc == 1) {
+        // Walk the records in order
+        size_t offset = sizeof(sessionHeader);
+        int number = 0;
+        while (offset < session.loaded) {
+            sessionRecord* rec = (sessionRecord*) (session.map + offset);
+            if (rec->type == SESSION_HISTORY) {
+                printf("%5d  %s\n", ++number, rec->text);
+            }
+            offset += rec->size;
+        }
+        return 0;
+    }
 
-    // If the user input is jobs, print the current jobs that are running
-    if (!strcmp(input, "jobs")) {
-        // Double check the jobs didn't finish already
-        checkBgProcesses(bgProc);
-        int i;
-        // Loop through all of the current background processes and print them
-        for (i = 0; i < numBgProcesses; i++) {
-            printf("[%d] %d: %s\n", i + 1, bgProc[i].PID, bgProc[i].cmd);
+    // Find the first line that is not before the prefix, then take lines while they start with it
+    size_t prefixLen = strlen(argv[1]);
+    int lo = 0, hi = session.indexSize;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(historyText(session.index[mid].offset), argv[1]) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        return 1;
     }
+    for (hi = lo; hi < session.indexSize && !strncmp(historyText(session.index[hi].offset), argv[1], prefixLen); hi++);
+
+    // Print them in the order they were entered
+    int numMatches = hi - lo;
+    historyEntry* matches = malloc((numMatches + 1) * sizeof(historyEntry));
+    memcpy(matches, session.index + lo, numMatches * sizeof(historyEntry));
+    int i, j;
+    for (i = 1; i < numMatches; i++) {
+        historyEntry match = matches[i];
+        for (j = i; j > 0 && matches[j - 1].number > match.number; j--) {
+            matches[j] = matches[j - 1];
+        }
+        matches[j] = match;
+    }
+    for (i = 0; i < numMatches; i++) {
+        printf("%5d  %s\n", matches[i].number, historyText(matches[i].offset));
+    }
+    free(matches);
+    return numMatches == 0;
+}
 
+// parallel [n] -- Prints how many program commands run at once, or runs up to n at once from now on
+int parallelCmd(int argc, char* argv[], jobTable* jobs) {
+    if (argc == 1) {
+        printf("parallel: %d\n", maxParallel);
+        return 0;
+    }
+    int newMax = atoi(argv[1]);
+    if (newMax < 1) {
+        printf("parallel: %s: must be a positive number\n", argv[1]);
+        return 1;
+    }
+    maxParallel = newMax;
     return 0;
 }
 
-/* Runs the all program commands
-* Inputs:
-*   input -- Char array that is the user's inputted value
-*   bgProc -- The struct that holds all background process information
-*/
-void programCmd(char input[500], bgProcess bgProc[]) {
-    // Get the command name
-    char* cmd;
-    char inputCopy[500];
-    strcpy(inputCopy, input);
-    cmd = strtok(inputCopy, " ");
+// time line -- Runs the line in the foreground and prints the resources each process used
+int timeCmd(int argc, char* argv[], jobTable* jobs) {
+    if (argc == 1) {
+        return 0;
+    }
+    tokenList rest = {argv + 1, argc - 1};
+    programCmd(&rest, jobs, 1);
+    return 0;
+}
 
-    // Get the total list
-    char* cmdArgs[20];
+// timing [on | off] -- Prints whether timing mode is on, or turns it on or off
+int timingCmd(int argc, char* argv[], jobTable* jobs) {
+    if (argc == 1) {
+        printf("timing: %s\n", timingMode ? "on" : "off");
+    } else if (!strcmp(argv[1], "on") || !strcmp(argv[1], "off")) {
+        timingMode = !strcmp(argv[1], "on");
+    } else {
+        printf("timing: %s: must be on or off\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
 
-    // Reset variables
-    strcpy(inputCopy, input);
+// wait -- Waits for every command started by the parallel scheduler
+int waitCmd(int argc, char* argv[], jobTable* jobs) {
+    waitForSlots(jobs, maxParallel);
+    return 0;
+}
 
-    // Get the first value in inputCopy
-    char* ptr = strtok(inputCopy, " ");
-    // Loop through inputCopy until it is NULL
+// jobs -- Prints the current jobs that are running
+int jobsCmd(int argc, char* argv[], jobTable* jobs) {
+    // Double check the jobs didn't finish already
+    checkBgProcesses(jobs);
     int i = 0;
-    while (ptr != NULL) {
-        cmdArgs[i++] = ptr;
-        ptr = strtok(NULL, " ");
+    bgProcess* proc;
+    // Loop through all of the current background processes in the order they started and print them
+    //  - Timing mode adds the resources each one has used so far
+    for (proc = jobs->first; proc != NULL; proc = proc->nextJob) {
+        printf("[%d] %d: %s", ++i, proc->PID, proc->cmd);
+        if (proc->settings != NULL) {
+            printf(" with %s", proc->settings);
+        }
+        struct rusage usage;
+        if (timingMode && readProcUsage(proc->PID, &usage)) {
+            printf(" Running");
+            printStatus(0, 0, NULL, secondsSince(&proc->start), &usage);
+        } else {
+            printf("\n");
+        }
     }
-
-    // Check if the final value is an ampersand (background process)
-    int bgProcess = 0;
-    if (!strcmp(cmdArgs[i - 1], "&")) {
-        cmdArgs[i - 1] = NULL;
-        bgProcess = 1;
-    } else {
-        // Add NULL to the end of the cmdArgs array
-        cmdArgs[i++] = NULL;
+    // In timing mode, also print the processes that finished, oldest first
+    if (timingMode && jobs->numFinished > 0) {
+        printf("Finished:\n");
+        int first = jobs->numFinished > FINISHED_JOBS ? jobs->numFinished - FINISHED_JOBS : 0;
+        for (i = first; i < jobs->numFinished; i++) {
+            finishedProcess* done = &jobs->finished[i % FINISHED_JOBS];
+            printStatus(done->PID, done->status, done->cmd, done->wallTime, &done->usage);
+        }
     }
+    return 0;
+}
 
-    // Create a pipe to pass data between the child and parent
-    int p[2];
-    pipe(p);
-    // Fork so that another process will run the command
-    int pid = fork();
-    // If pid is less than 0, it means the fork failed
-    // Else if pid is equal to 0, it is the child process
-    // Else, it is the parent process
-    if (pid < 0) {
-        printf("Fork failed.\n");
-        exit(1);
-    } else if (pid == 0) {
-        // Lock the mutex
-        pthread_mutex_lock(&mut);
-        // Wait for the signal to execute the command
-        pthread_cond_wait(&child_cv, &mut);
-        // Close the read end of the pipe
-        close(p[0]);
-        // Execute the command
-        int status = execvp(cmd, cmdArgs);
-        // Write the status to the pipe
-        write(p[1], &status, sizeof(status));
-        // If the status is a -1, print that the command didn't exist
-        // Otherwise, if bgFlag is 1, print that the background process was killed
-        if (status == -1) {
-            printf("Cannot exec %s: No such file or directory\n", cmd);
-        }
-        // Unlock the mutex
-        pthread_mutex_unlock(&mut);
-        // Kill the child process
-        kill(getpid(), SIGTERM);
-    } else {
-        // Remove the */bin/*
-        cmd = basename(cmd);
-        // This is where the parent process will go
-        // Print the child's process ID & the command to run
-        printf("[%d] %s\n", pid, cmd);
-        // Signal the child_cv conditional
-        pthread_cond_broadcast(&child_cv);
-        // If it is not a background process, wait on the child, if it is, do not wait on the child
-        int status;
-        if (!bgProcess) {
-            // Wait on the child process to get killed
-            waitpid(pid, &status, 0);
-            // Get the child's execution status via the pipe
-            int execStatus = 0;
-            close(p[1]);
-            read(p[0], &execStatus, sizeof(execStatus));
-            // Call a helper to print the status
-            if (execStatus == -1) {
-                printStatus(pid, execStatus, cmd);
+// true -- Does nothing, successfully
+int trueCmd(int argc, char* argv[], jobTable* jobs) {
+    return 0;
+}
+
+// false -- Does nothing, unsuccessfully
+int falseCmd(int argc, char* argv[], jobTable* jobs) {
+    return 1;
+}
+
+// echo [-neE] [word...] -- Prints the words, like /bin/echo
+int echoCmd(int argc, char* argv[], jobTable* jobs) {
+    // Read the options - a word is only options if every letter is one
+    int newline = 1, escapes = 0, i = 1;
+    while (i < argc && argv[i][0] == '-' && argv[i][1] && strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1)) {
+        char* opt;
+        for (opt = argv[i] + 1; *opt; opt++) {
+            if (*opt == 'n') {
+                newline = 0;
             } else {
-                printStatus(pid, status, cmd);
+                escapes = *opt == 'e';
             }
-        } else {
-            // Do not wait for the child process but still track the status
-            waitpid(-1, &status, WNOHANG);
-            // Assign struct values
-            bgProc[numBgProcesses].PID = pid;
-            bgProc[numBgProcesses].cmd = malloc(sizeof(cmd));
-            strncpy(bgProc[numBgProcesses++].cmd, cmd, sizeof(cmd));
         }
+        i++;
+    }
+    // Print the words, stopping at \c
+    for (; i < argc; i++) {
+        if (!printText(argv[i], escapes)) {
+            return 0;
+        }
+        if (i + 1 < argc) {
+            putchar(' ');
+        }
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 0;
+}
 
-        // Check if the command was a kill
-        if (!strcmp(cmd, "kill")) {
-            // Check if the kill was killing a background process
-            int pidKilled = atoi(cmdArgs[1]);
-            int j, flag = 0;
-            for (j = 0; j < numBgProcesses; j++) {
-                // If this is the right process, break out of the for loop
-                if (pidKilled == bgProc[j].PID) {
-                    flag = 1;
-                    break;
+// printf format [argument...] -- Prints the arguments with the format, like /usr/bin/printf
+//  - The format is reused while arguments are left, and missing arguments count as empty or 0
+//  - An argument that is not a whole number for a number conversion is printed as far as it goes, and the status is 1
+//  - An argument starting with a quote gives the code of the character after it to a number conversion
+//  - A format with a conversion not handled here, like %q or %*d, is left to the printf program
+int printfCmd(int argc, char* argv[], jobTable* jobs) {
+    if (argc < 2) {
+        printf("printf: missing operand\n");
+        return 1;
+    }
+    // Check every conversion before printing anything, skipping escapes and %%
+    char* f;
+    for (f = argv[1]; *f; f++) {
+        if (*f == '\\' && f[1]) {
+            f++;
+        } else if (*f == '%' && *++f != '%') {
+            f += strspn(f, "-+ #0123456789.");
+            if (*f == 0 || strchr("diouxXfeEgGaAcsb", *f) == NULL) {
+                return RUN_PROGRAM;
+            }
+        }
+    }
+    int arg = 2, used, status = 0;
+    do {
+        used = arg;
+        f = argv[1];
+        while (*f) {
+            // Print plain characters and escapes
+            if (*f == '\\') {
+                char escape[5] = {0};
+                strncpy(escape, f, 4);
+                int len = 2;
+                if (escape[1] >= '0' && escape[1] <= '7') {
+                    len = 1 + strspn(escape + 1, "01234567");
+                } else if (escape[1] == 'x') {
+                    len = 2 + strspn(escape + 2, "0123456789abcdefABCDEF");
                 }
+                escape[len] = 0;
+                if (!printText(escape, 1)) {
+                    return 0;
+                }
+                f += escape[1] ? len : 1;
+                continue;
+            } else if (*f != '%') {
+                putchar(*f++);
+                continue;
+            } else if (f[1] == '%') {
+                putchar('%');
+                f += 2;
+                continue;
             }
-            // Break out if it was not a background process
-            if (flag) {
-                // Ensure the kill worked by attempting to send the process a signal
-                int killRet = kill(bgProc[j].PID, 0); // Signal 0 means it won't terminate
-                // Kill succeeded so print that the command was killed and update the struct
-                if (killRet == 0) {
-                    // Print that the process was killed
-                    printf("[%d] %s Killed (%d)\n", bgProc[j].PID, bgProc[j].cmd, SIGTERM);
-                    // Call a helper to remove the background process
-                    removeBgProcess(bgProc, j);
+
+            // Copy the conversion - the flags, width and precision, then the letter
+            char spec[40];
+            int len = 0;
+            spec[len++] = *f++;
+            while (*f && strchr("-+ #0123456789.", *f) && len < 30) {
+                spec[len++] = *f++;
+            }
+            char conv = *f ? *f++ : 0;
+            char* value = arg < argc ? argv[arg++] : NULL;
+
+            // A number conversion needs the whole argument to be the number
+            long long number = 0;
+            unsigned long long unsignedNumber = 0;
+            double real = 0;
+            if (value != NULL && conv && strchr("diouxXfeEgGaA", conv)) {
+                char* end;
+                if (value[0] == '\'' || value[0] == '"') {
+                    number = (unsigned char) value[1];
+                    unsignedNumber = number;
+                    real = number;
+                    // Only the first character counts, as in the printf program
+                    end = value + strlen(value);
+                } else if (strchr("di", conv)) {
+                    number = strtoll(value, &end, 0);
+                } else if (strchr("ouxX", conv)) {
+                    unsignedNumber = strtoull(value, &end, 0);
+                } else {
+                    real = strtod(value, &end);
+                }
+                if (end == value || *end) {
+                    printf("printf: '%s': expected a numeric value\n", value);
+                    status = 1;
+                }
+            }
+
+            // Print the argument with it
+            if (conv && strchr("di", conv)) {
+                strcpy(spec + len, "lld");
+                printf(spec, number);
+            } else if (conv && strchr("ouxX", conv)) {
+                sprintf(spec + len, "ll%c", conv);
+                printf(spec, unsignedNumber);
+            } else if (conv && strchr("feEgGaA", conv)) {
+                sprintf(spec + len, "%c", conv);
+                printf(spec, real);
+            } else if (conv == 'c') {
+                strcpy(spec + len, "c");
+                printf(spec, value ? value[0] : 0);
+            } else if (conv == 's') {
+                strcpy(spec + len, "s");
+                printf(spec, value ? value : "");
+            } else if (conv == 'b') {
+                // %b prints the argument with its escapes
+                if (value != NULL && !printText(value, 1)) {
+                    return 0;
                 }
+            } else {
+                printf("printf: %%%c: invalid conversion\n", conv);
+                return 1;
             }
         }
+    } while (arg < argc && arg > used);
+    return status;
+}
+
+// sleep number[smhd]... -- Sleeps for the total of the times, like /bin/sleep - with parallel commands on, /bin/sleep runs instead
+int sleepCmd(int argc, char* argv[], jobTable* jobs) {
+    if (argc < 2) {
+        printf("sleep: missing operand\n");
+        return 1;
+    }
+    // Add up the times
+    double seconds = 0;
+    int i;
+    for (i = 1; i < argc; i++) {
+        char* end;
+        double value = strtod(argv[i], &end);
+        double unit = 1;
+        if (*end == 'm') {
+            unit = 60;
+        } else if (*end == 'h') {
+            unit = 3600;
+        } else if (*end == 'd') {
+            unit = 86400;
+        }
+        if (end == argv[i] || value < 0 || (*end && (strchr("smhd", *end) == NULL || end[1]))) {
+            printf("sleep: invalid time interval '%s'\n", argv[i]);
+            return 1;
+        }
+        seconds += value * unit;
     }
-    
-    // Ensure the cmdArgs array is empty to not affect future executions
-    while (i >= 0) {
-        cmdArgs[i--] = '\0';
+    // Sleep, picking up where it left off if interrupted
+    struct timespec remaining = {(time_t) seconds, (long) ((seconds - (time_t) seconds) * 1e9)};
+    while (nanosleep(&remaining, &remaining) != 0 && errno == EINTR);
+    return 0;
+}
+
+// test expression, or [ expression ] -- Checks a file, string or number, like /usr/bin/test
+int testCmd(int argc, char* argv[], jobTable* jobs) {
+    // [ needs a closing ]
+    if (!strcmp(argv[0], "[")) {
+        if (strcmp(argv[argc - 1], "]")) {
+            printf("[: missing ']'\n");
+            return 2;
+        }
+        argc--;
     }
+    int result = evalTest(argc - 1, argv + 1);
+    return result < 0 ? 2 : !result;
 }
 
-/* Checks if any background processes have finished
+/* Evaluates a test expression
+*  - Handles !, one word, a unary file or string check, and a binary string or number comparison
+*  - A number comparison with a word that is not a whole number prints an error
+*
 * Inputs:
-*   bgProc -- The struct that holds all background process information
+*   numArgs -- The number of words in the expression
+*   args -- The words
+*
+* Outputs:
+*   int -- 1 if the expression is true; 0 if it is false or cannot be evaluated; -1 if a number comparison has a bad number
 */
-void checkBgProcesses(bgProcess bgProc[]) {
-    // Check if there were any background processes & if they finished
-    int status;
-    int backgroundPID = waitpid(-1, &status, WNOHANG);
-    while (backgroundPID > 0) {
-        // Find the process that this ID is associated with
+int evalTest(int numArgs, char* args[]) {
+    if (numArgs == 0) {
+        return 0;
+    }
+    if (!strcmp(args[0], "!")) {
+        int result = evalTest(numArgs - 1, args + 1);
+        return result < 0 ? result : !result;
+    }
+    if (numArgs == 1) {
+        return args[0][0] != 0;
+    }
+
+    // Unary checks
+    if (numArgs == 2) {
+        struct stat info;
+        char* op = args[0], * arg = args[1];
+        if (!strcmp(op, "-z")) {
+            return arg[0] == 0;
+        } else if (!strcmp(op, "-n")) {
+            return arg[0] != 0;
+        } else if (!strcmp(op, "-r")) {
+            return access(arg, R_OK) == 0;
+        } else if (!strcmp(op, "-w")) {
+            return access(arg, W_OK) == 0;
+        } else if (!strcmp(op, "-x")) {
+            return access(arg, X_OK) == 0;
+        } else if (!strcmp(op, "-L") || !strcmp(op, "-h")) {
+            return lstat(arg, &info) == 0 && S_ISLNK(info.st_mode);
+        } else if (stat(arg, &info) != 0) {
+            return 0;
+        } else if (!strcmp(op, "-e")) {
+            return 1;
+        } else if (!strcmp(op, "-f")) {
+            return S_ISREG(info.st_mode);
+        } else if (!strcmp(op, "-d")) {
+            return S_ISDIR(info.st_mode);
+        } else if (!strcmp(op, "-s")) {
+            return info.st_size > 0;
+        }
+        return 0;
+    }
+
+    // Binary comparisons
+    if (numArgs == 3) {
+        char* op = args[1];
+        if (!strcmp(op, "=") || !strcmp(op, "==")) {
+            return !strcmp(args[0], args[2]);
+        } else if (!strcmp(op, "!=")) {
+            return strcmp(args[0], args[2]) != 0;
+        }
+        if (strlen(op) != 3 || op[0] != '-' || strstr("-eq-ne-lt-le-gt-ge", op) == NULL) {
+            return 0;
+        }
+        // Both sides must be whole numbers, with optional blanks around them
+        long long values[2];
         int i;
-        for (i = 0; i < numBgProcesses; i++) {
-            // If this is the right process, break out of the for loop
-            if (backgroundPID == bgProc[i].PID) {
-                // Print the background processes status
-                printStatus(backgroundPID, status, bgProc[i].cmd);
-                backgroundPID = 0;
-                // Clean up the process in the struct
-                removeBgProcess(bgProc, i);
-                break;
+        for (i = 0; i < 2; i++) {
+            char* word = args[i * 2], * end;
+            errno = 0;
+            values[i] = strtoll(word, &end, 10);
+            end += strspn(end, " \t");
+            if (end == word || *end || errno == ERANGE || strspn(word, " \t") == strlen(word)) {
+                printf("test: %s: integer expression expected\n", word);
+                return -1;
             }
         }
-        // Check for a new backgroundPID
-        backgroundPID = waitpid(-1, &status, WNOHANG);
+        long long a = values[0], b = values[1];
+        if (!strcmp(op, "-eq")) {
+            return a == b;
+        } else if (!strcmp(op, "-ne")) {
+            return a != b;
+        } else if (!strcmp(op, "-lt")) {
+            return a < b;
+        } else if (!strcmp(op, "-le")) {
+            return a <= b;
+        } else if (!strcmp(op, "-gt")) {
+            return a > b;
+        } else if (!strcmp(op, "-ge")) {
+            return a >= b;
+        }
     }
+    return 0;
 }
 
-/* Prints the status message of a command
+/* Prints text, expanding backslash escapes if asked
 * Inputs:
-*   pid -- The PID of the process that has exited
-*   status -- The status of the process that has exited
-*   cmd -- The command ran for the process that has exited
+*   text -- The text
+*   escapes -- 1 to expand \n, \t, \\, \0nnn, \xHH and the other escapes echo -e knows; 0 to print it as it is
+*
+* Outputs:
+*   int -- 0 if a \c said to stop printing; 1 otherwise
 */
-void printStatus(int pid, int status, char* cmd) {
-    // Print the child's process ID & the command that was attempted to be run & exit status
-    if (WIFEXITED(status)) {
-        printf("[%d] %s Exit %d\n", pid, cmd, WEXITSTATUS(status));
-    } else if (WIFSIGNALED(status)) {
-        printf("[%d] %s Exit %d\n", pid, cmd, WTERMSIG(status));
-    } else if (status == -1) {
-        printf("[%d] %s Exit %d\n", pid, cmd, 255);
+int printText(char* text, int escapes) {
+    if (!escapes) {
+        fputs(text, stdout);
+        return 1;
+    }
+    while (*text) {
+        if (*text != '\\' || !text[1]) {
+            putchar(*text++);
+            continue;
+        }
+        text++;
+        char c = *text++;
+        switch (c) {
+            case 'a': putchar('\a'); break;
+            case 'b': putchar('\b'); break;
+            case 'c': return 0;
+            case 'e': putchar(27); break;
+            case 'f': putchar('\f'); break;
+            case 'n': putchar('\n'); break;
+            case 'r': putchar('\r'); break;
+            case 't': putchar('\t'); break;
+            case 'v': putchar('\v'); break;
+            case '\\': putchar('\\'); break;
+            case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': {
+                // Up to three octal digits, after an optional leading 0
+                int value = 0, digits = 0;
+                text -= c != '0';
+                while (digits < 3 && *text >= '0' && *text <= '7') {
+                    value = value * 8 + (*text++ - '0');
+                    digits++;
+                }
+                putchar(value);
+                break;
+            }
+            case 'x': {
+                // Up to two hex digits - with none, the escape is printed as it is
+                int value = 0, digits = 0;
+                while (digits < 2 && isxdigit((unsigned char) *text)) {
+                    value = value * 16 + (isdigit((unsigned char) *text) ? *text - '0' : (tolower((unsigned char) *text) - 'a' + 10));
+                    text++;
+                    digits++;
+                }
+                if (digits) {
+                    putchar(value);
+                } else {
+                    putchar('\\');
+                    putchar('x');
+                }
+                break;
+            }
+            default: putchar('\\'); putchar(c); break;
+        }
     }
+    return 1;
 }
 
-/* Removes a background process from the struct
+/* Runs the all program commands
+*  - Commands can be joined into a pipeline with |
+*  - Each command can read from a file with < file and write to files with > file or >> file
+*  - A command with more than one output file has its output copied to all of them by the shell
+*  - A line with only redirections copies the < file to the output files, or to the terminal if there are none
+*  - Words like cpus=0-3 before the command are launch settings for every process of the line
+*  - Everything for the line is allocated in the line arena
+*
 * Inputs:
-*   bgProc -- The struct that holds all background process information
-*   idx -- The index of the background process to remove
+*   line -- The words of the user's inputted value
+*   jobs -- The table that holds all background process information
+*   timed -- 1 to run the line in the foreground and print the resources each process used, for the time builtin
 */
-void removeBgProcess(bgProcess bgProc[], int idx) {
-    // Move all following processes forward one
-    int i, j;
-    for (i = idx; i < (numBgProcesses - 1); i++) {
-        // Move values forward one
-        j = i + 1;
-        strncpy(bgProc[i].cmd, bgProc[j].cmd, sizeof(bgProc[j].cmd));
-        bgProc[i].PID = bgProc[j].PID;
-    }
-    // Reset the values at the ending index & decrement total processes
-    bgProc[--numBgProcesses].cmd = '\0';
-    bgProc[numBgProcesses].PID = 0;
+void programCmd(tokenList* line, jobTable* jobs, int timed) {
+    char** tokens = line->words;
+    int numTokens = line->count;
+
+    // Check if the final value is an ampersand (background process)
+    int bgFlag = 0;
+    if (tokens[numTokens - 1] == operators[4] && !timed) {
+        numTokens--;
+        bgFlag = 1;
+    }
+
+    // Take the launch settings off the front
+    launchSettings settings;
+    memset(&settings, 0, sizeof(settings));
+    int first = 0, isSetting;
+    size_t settingsLen = 0;
+    while (first < numTokens && !isOperator(tokens[first]) && (isSetting = parseSetting(&settings, tokens[first])) != 0) {
+        if (isSetting < 0) {
+            printf("Invalid launch setting %s\n", tokens[first]);
+            return;
+        }
+        settingsLen += strlen(tokens[first++]) + 1;
+    }
+    if (first > 0 && first == numTokens) {
+        printf("Launch settings need a command\n");
+        return;
+    }
+    if (first > 0) {
+        // Keep the settings as they were typed, for jobs
+        int j;
+        settings.text = arenaAlloc(settingsLen);
+        settings.text[0] = 0;
+        for (j = 0; j < first; j++) {
+            strcat(strcat(settings.text, j ? " " : ""), tokens[j]);
+        }
+    }
+
+    // Split the words into stages
+    //  - Arguments are copied into cmdArgs with a NULL after each stage
+    //  - Output files are listed in outFiles in stage order
+    char** cmdArgs = arenaAlloc((numTokens + 1) * sizeof(char*));
+    stage* stages = arenaAlloc((numTokens + 1) * sizeof(stage));
+    outFile* outFiles = arenaAlloc((numTokens + 1) * sizeof(outFile));
+    int numArgs = 0, numStages = 1, numOutFiles = 0;
+    int i;
+    stages[0] = (stage) {.args = cmdArgs};
+    for (i = first; i < numTokens; i++) {
+        stage* curr = &stages[numStages - 1];
+        if (tokens[i] == operators[4]) {
+            // & can only end the line
+            printf("Syntax error near &\n");
+            return;
+        } else if (tokens[i] == operators[0]) {
+            // End this stage and start the next - neither can be empty
+            if (numArgs == curr->args - cmdArgs) {
+                printf("Syntax error near |\n");
+                return;
+            }
+            cmdArgs[numArgs++] = NULL;
+            stages[numStages++] = (stage) {.args = &cmdArgs[numArgs], .firstOut = numOutFiles};
+        } else if (isOperator(tokens[i])) {
+            // Every redirection needs a file name
+            if (i + 1 == numTokens || isOperator(tokens[i + 1])) {
+                printf("Syntax error near %s\n", tokens[i]);
+                return;
+            }
+            if (tokens[i][0] == '<') {
+                curr->inFile = tokens[++i];
+            } else {
+                outFiles[numOutFiles].flags = O_WRONLY | O_CREAT | O_CLOEXEC | (tokens[i][1] ? O_APPEND : O_TRUNC);
+                outFiles[numOutFiles++].name = tokens[++i];
+                curr->numOut++;
+            }
+        } else {
+            cmdArgs[numArgs++] = tokens[i];
+        }
+    }
+    cmdArgs[numArgs++] = NULL;
+    if (stages[numStages - 1].args[0] == NULL && numStages > 1) {
+        printf("Syntax error near |\n");
+        return;
+    }
+
+    // Open every file up front so a bad name stops the whole line
+    for (i = 0; i < numStages; i++) {
+        stages[i].inFd = 0;
+        if (stages[i].inFile != NULL && (stages[i].inFd = open(stages[i].inFile, O_RDONLY | O_CLOEXEC)) < 0) {
+            printf("%s: %s\n", stages[i].inFile, strerror(errno));
+            closeFiles(stages, i, outFiles, 0);
+            return;
+        }
+    }
+    for (i = 0; i < numOutFiles; i++) {
+        if ((outFiles[i].fd = open(outFiles[i].name, outFiles[i].flags, 0644)) < 0) {
+            printf("%s: %s\n", outFiles[i].name, strerror(errno));
+            closeFiles(stages, numStages, outFiles, i);
+            return;
+        }
+    }
+
+    // A line with only redirections runs no command
+    if (stages[0].args[0] == NULL) {
+        if (stages[0].inFd != 0) {
+            // Copy the input file to the output files, or to the terminal
+            int* outFds = arenaAlloc((numOutFiles + 1) * sizeof(int));
+            outFds[0] = 1;
+            for (i = 0; i < numOutFiles; i++) {
+                outFds[i] = outFiles[i].fd;
+            }
+            fflush(stdout);
+            pumpData(stages[0].inFd, 0, outFds, numOutFiles ? numOutFiles : 1);
+        }
+        closeFiles(stages, numStages, outFiles, numOutFiles);
+        return;
+    }
+
+    // Run the line on the parallel scheduler unless it is a background process
+    //  - It starts once there is a free slot for each stage, or once nothing else is running
+    int parallelFlag = !bgFlag && !timed && maxParallel > 1;
+    if (parallelFlag) {
+        waitForSlots(jobs, numStages < maxParallel ? numStages : maxParallel);
+    }
+
+    // Flush anything the shell printed so it comes out before the children's output
+    fflush(stdout);
+
+    // Start every stage, connecting each one to the next with a pipe
+    struct timespec lineStart;
+    clock_gettime(CLOCK_MONOTONIC, &lineStart);
+    int nextIn = 0, numFans = 0;
+    for (i = 0; i < numStages; i++) {
+        stage* curr = &stages[i];
+        // Read from the previous stage, unless the stage reads from a file
+        if (curr->inFd == 0) {
+            curr->inFd = nextIn;
+        } else if (nextIn != 0) {
+            close(nextIn);
+        }
+        nextIn = 0;
+        // Write to the next stage, to the one output file, or to a pipe the shell copies to every output file
+        int outFd = 1, p[2];
+        curr->fanFd = -1;
+        if (curr->numOut == 1) {
+            outFd = outFiles[curr->firstOut].fd;
+        } else if (curr->numOut > 1) {
+            pipe2(p, O_CLOEXEC);
+            curr->fanFd = p[0];
+            outFd = p[1];
+            numFans++;
+        }
+        if (i + 1 < numStages) {
+            pipe2(p, O_CLOEXEC);
+            nextIn = p[0];
+            if (curr->numOut == 0) {
+                outFd = p[1];
+            } else {
+                // The output went to files, so the next stage just gets an empty input
+                close(p[1]);
+            }
+        }
+
+        // Start the stage, then close the shell's copies of its input and output
+        curr->pid = launchCmd(curr->args[0], curr->args, curr->inFd, outFd, settings.text != NULL ? &settings : NULL);
+        if (curr->inFd != 0) {
+            close(curr->inFd);
+        }
+        if (outFd != 1 && (curr->numOut != 1)) {
+            close(outFd);
+        }
+
+        // Print the child's process ID & the command to run, removing the */bin/*
+        if (curr->pid < 0 && settings.failed) {
+            printf("Cannot apply %s for %s: %s\n", settingNames[settings.failed], curr->args[0], strerror(errno));
+        } else if (curr->pid < 0) {
+            printf("Cannot exec %s: %s\n", curr->args[0], strerror(errno));
+        } else {
+            if (!quietJobs) {
+                printf("[%d] %s\n", curr->pid, basename(curr->args[0]));
+            }
+        }
+    }
+
+    // Copy the output of every stage with several output files
+    //  - Data only flows forward, so the stages can be copied one after another
+    //  - A background line copies in a child of the shell so the prompt comes back
+    int pumpPid = 0;
+    if (numFans && bgFlag) {
+        pumpPid = fork();
+    }
+    if (numFans && pumpPid == 0) {
+        for (i = 0; i < numStages; i++) {
+            if (stages[i].fanFd >= 0) {
+                int* outFds = arenaAlloc(stages[i].numOut * sizeof(int));
+                int j;
+                for (j = 0; j < stages[i].numOut; j++) {
+                    outFds[j] = dup(outFiles[stages[i].firstOut + j].fd);
+                }
+                pumpData(stages[i].fanFd, 1, outFds, stages[i].numOut);
+                for (j = 0; j < stages[i].numOut; j++) {
+                    close(outFds[j]);
+                }
+            }
+        }
+        if (bgFlag) {
+            _exit(0);
+        }
+    }
+    for (i = 0; i < numStages; i++) {
+        if (stages[i].fanFd >= 0) {
+            close(stages[i].fanFd);
+        }
+    }
+    for (i = 0; i < numOutFiles; i++) {
+        close(outFiles[i].fd);
+    }
+
+    // If it is not a background process, wait on the children, if it is, do not wait on the children
+    for (i = 0; i < numStages; i++) {
+        char* cmd = basename(stages[i].args[0]);
+        if (stages[i].pid < 0) {
+            continue;
+        }
+        int status;
+        if (!bgFlag && !parallelFlag) {
+            // Wait on the child process to finish
+            struct rusage usage;
+            wait4(stages[i].pid, &status, 0, &usage);
+            // Call a helper to print the status
+            reportProcess(jobs, stages[i].pid, status, cmd, &lineStart, timed ? 2 : 0, &usage);
+        } else {
+            // Do not wait for the child process but track it until it is reaped
+            addBgProcess(jobs, stages[i].pid, cmd, parallelFlag, settings.text);
+        }
+
+        // Check if the command was a kill
+        if (!strcmp(cmd, "kill") && stages[i].args[1] != NULL) {
+            // Check if the kill was killing a background process
+            bgProcess* killed = findBgProcess(jobs, atoi(stages[i].args[1]));
+            // Break out if it was not a background process
+            if (killed != NULL) {
+                // Ensure the kill worked by attempting to send the process a signal
+                int killRet = kill(killed->PID, 0); // Signal 0 means it won't terminate
+                // Kill succeeded so print that the command was killed and update the table
+                if (killRet == 0) {
+                    // Print that the process was killed
+                    printf("[%d] %s Killed (%d)\n", killed->PID, killed->cmd, SIGTERM);
+                    // Call a helper to remove the background process
+                    removeBgProcess(jobs, killed);
+                }
+            }
+        }
+    }
+}
+
+/* Closes the files opened for a line
+* Inputs:
+*   stages -- The stages of the line
+*   numStages -- The number of stages whose input file is open
+*   outFiles -- The output files of the line
+*   numOutFiles -- The number of output files that are open
+*/
+void closeFiles(stage stages[], int numStages, outFile outFiles[], int numOutFiles) {
+    int i;
+    for (i = 0; i < numStages; i++) {
+        if (stages[i].inFd > 0) {
+            close(stages[i].inFd);
+        }
+    }
+    for (i = 0; i < numOutFiles; i++) {
+        close(outFiles[i].fd);
+    }
+}
+
+/* Copies everything from one file into several without passing it through the shell's memory
+*  - splice moves data between a pipe and a file inside the kernel
+*  - tee copies the data at the front of a pipe into a scratch pipe for every output but the last
+*  - The last output gets the original data moved with splice
+*
+* Inputs:
+*   inFd -- The file to copy from
+*   inIsPipe -- 1 if inFd is the read end of a pipe; 0 if it is a regular file
+*   outFds -- The files to copy to
+*   numOut -- The number of files to copy to
+*  - Stops at the first output that cannot be written, since the pipes would fill up and never drain
+*/
+void pumpData(int inFd, int inIsPipe, int outFds[], int numOut) {
+    // A regular file is first moved into a pipe so it can be copied with tee
+    int feed[2] = {-1, -1}, scratch[2];
+    int src = inFd;
+    if (!inIsPipe) {
+        pipe2(feed, O_CLOEXEC);
+        src = feed[0];
+    }
+    pipe2(scratch, O_CLOEXEC);
+
+    while (1) {
+        // Get the next chunk to the front of the pipe
+        int k = 0;
+        ssize_t n;
+        if (inIsPipe) {
+            // Copy whatever is waiting for the first output, which also tells how much there is
+            n = tee(src, scratch[1], PUMP_CHUNK, 0);
+            if (n <= 0 || !moveData(scratch[0], outFds[k++], n)) {
+                break;
+            }
+        } else {
+            n = splice(inFd, NULL, feed[1], NULL, PUMP_CHUNK, SPLICE_F_MOVE);
+            if (n <= 0) {
+                break;
+            }
+        }
+        // Copy the chunk for every output but the last
+        for (; k < numOut - 1; k++) {
+            if (tee(src, scratch[1], n, 0) != n || !moveData(scratch[0], outFds[k], n)) {
+                break;
+            }
+        }
+        // Move the chunk itself into the last output
+        if (k < numOut - 1 || !moveData(src, outFds[numOut - 1], n)) {
+            break;
+        }
+    }
+
+    // Clean up
+    if (!inIsPipe) {
+        close(feed[0]);
+        close(feed[1]);
+    }
+    close(scratch[0]);
+    close(scratch[1]);
+}
+
+/* Moves bytes from the front of a pipe into a file
+*  - Falls back to read and write for files splice cannot write to, like terminals and files opened with >>
+*
+* Inputs:
+*   pipeFd -- The read end of the pipe
+*   outFd -- The file to write to
+*   n -- The number of bytes to move
+*
+* Outputs:
+*   int -- 1 if all n bytes were moved; 0 if the file could not be written or the pipe ran out
+*/
+int moveData(int pipeFd, int outFd, ssize_t n) {
+    while (n > 0) {
+        ssize_t moved = splice(pipeFd, NULL, outFd, NULL, n, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINVAL) {
+            char buf[PUMP_CHUNK];
+            moved = read(pipeFd, buf, n < PUMP_CHUNK ? n : PUMP_CHUNK);
+            if (moved > 0 && write(outFd, buf, moved) < 0) {
+                moved = -1;
+            }
+        }
+        if (moved <= 0) {
+            return 0;
+        }
+        n -= moved;
+    }
+    return 1;
+}
+
+/* Splits a line into words in the line arena
+*  - Words are split on spaces and tabs, and a # starting a word begins a comment
+*  - Single quotes keep everything inside as it is
+*  - Double quotes keep everything inside except \\, \", \$ and \`, which lose their backslash
+*  - A backslash outside quotes keeps the next character as it is
+*  - Unquoted |, <, >, >> and & are words of their own even without spaces around them, and point into operators
+*
+* Inputs:
+*   text -- The line
+*   line -- Set to the words of the line
+*
+* Outputs:
+*   int -- 1 if the line was split; 0 if a quote was left open
+*/
+int tokenize(char* text, tokenList* line) {
+    // A line of n characters has fewer than n words, which need less than 2n characters with their NULs
+    size_t len = strlen(text);
+    char* out = arenaAlloc(2 * len + 2);
+    line->words = arenaAlloc((len + 2) * sizeof(char*));
+    line->count = 0;
+
+    char* ptr = text;
+    while (1) {
+        // Skip the whitespace, then stop at the end of the line or a comment
+        while (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r') {
+            ptr++;
+        }
+        if (*ptr == 0 || *ptr == '#') {
+            break;
+        }
+
+        // Operators
+        if (strchr("|<>&", *ptr)) {
+            int op = strchr("|<>&", *ptr) - "|<>&";
+            if (*ptr == '>' && ptr[1] == '>') {
+                op = 3;
+                ptr++;
+            } else if (*ptr == '&') {
+                op = 4;
+            }
+            line->words[line->count++] = operators[op];
+            ptr++;
+            continue;
+        }
+
+        // Copy the word, removing its quotes, up to unquoted whitespace or an operator
+        line->words[line->count++] = out;
+        char quote = 0;
+        while (*ptr && (quote || !strchr(" \t\n\r|<>&", *ptr))) {
+            if (quote == '\'') {
+                // Everything but the closing quote is kept
+                if (*ptr != '\'') {
+                    *out++ = *ptr;
+                } else {
+                    quote = 0;
+                }
+                ptr++;
+            } else if (*ptr == '\\' && ptr[1] && (!quote || strchr("\"\\$`", ptr[1]))) {
+                // Escaped character
+                *out++ = ptr[1];
+                ptr += 2;
+            } else if (*ptr == '"' && quote) {
+                quote = 0;
+                ptr++;
+            } else if ((*ptr == '"' || *ptr == '\'') && !quote) {
+                quote = *ptr++;
+            } else {
+                *out++ = *ptr++;
+            }
+        }
+        if (quote) {
+            printf("Syntax error: unmatched %c\n", quote);
+            return 0;
+        }
+        *out++ = 0;
+    }
+    line->words[line->count] = NULL;
+    return 1;
+}
+
+/* Replaces every $(command) in a line with the output of the command
+*  - Nothing inside single quotes is replaced
+*  - Trailing newlines are removed from the output
+*  - Outside double quotes the output is split into words on whitespace, inside them it stays one word
+*  - The output is escaped so quotes and operators in it are kept as text by tokenize
+*  - A # starting a word outside quotes ends the line, as in tokenize, so nothing in a comment is run
+*
+* Inputs:
+*   text -- The line
+*   jobs -- The table that holds all background process information
+*
+* Outputs:
+*   char* -- The line in the line arena, NULL if a $( was left open
+*/
+char* expandLine(char* text, jobTable* jobs) {
+    size_t cap = strlen(text) + 1, used = 0;
+    char* out = arenaAlloc(cap);
+    char quote = 0;
+    int wordStart = 1; // 1 if the next character starts a word, the same way tokenize splits them
+    char* ptr = text;
+    while (*ptr) {
+        out = reserveText(out, used, &cap, 3);
+        if (!quote && wordStart && *ptr == '#') {
+            // The rest is a comment
+            break;
+        } else if (quote != '\'' && *ptr == '\\' && ptr[1]) {
+            // Keep escapes for tokenize, so \$( is not replaced
+            out[used++] = *ptr++;
+            out[used++] = *ptr++;
+            wordStart = 0;
+        } else if (quote != '\'' && ptr[0] == '$' && ptr[1] == '(') {
+            char* end = findClose(ptr + 2);
+            if (end == NULL) {
+                printf("Syntax error: unmatched (\n");
+                return NULL;
+            }
+
+            // Run the command, ending its text at the )
+            captureBuffer* buf = getCapture();
+            *end = 0;
+            int captured = captureCmd(ptr + 2, jobs, buf);
+            *end = ')';
+            ptr = end + 1;
+            if (!captured) {
+                putCapture(buf);
+                continue;
+            }
+            while (buf->used > 0 && buf->data[buf->used - 1] == '\n') {
+                buf->used--;
+            }
+
+            // Copy the output in, with at most one escape per character
+            out = reserveText(out, used, &cap, buf->used * 2 + 1);
+            size_t i;
+            for (i = 0; i < buf->used; i++) {
+                char c = buf->data[i];
+                if (c == 0) {
+                    continue;
+                } else if (quote) {
+                    if (strchr("\"\\$`", c)) {
+                        out[used++] = '\\';
+                    }
+                } else if (c == '\n' || c == '\t' || c == '\r') {
+                    c = ' ';
+                } else if (strchr("|<>&'\"\\#$`", c)) {
+                    out[used++] = '\\';
+                }
+                out[used++] = c;
+                // Only whitespace in the output ends a word - everything else in it was escaped
+                wordStart = !quote && c == ' ';
+            }
+            putCapture(buf);
+        } else {
+            // Track the quotes, so single quoted text is left alone
+            if (*ptr == quote) {
+                quote = 0;
+            } else if (!quote && (*ptr == '\'' || *ptr == '"')) {
+                quote = *ptr;
+            }
+            wordStart = !quote && strchr(" \t\n\r|<>&", *ptr) != NULL;
+            out[used++] = *ptr++;
+        }
+    }
+    out[used] = 0;
+    return out;
+}
+
+/* Finds the ) that closes a command substitution
+*  - Parentheses are counted, and ones inside quotes or escaped are skipped
+*
+* Inputs:
+*   ptr -- The text just after the $(
+*
+* Outputs:
+*   char* -- The closing ), NULL if there is none
+*/
+char* findClose(char* ptr) {
+    int depth = 1;
+    char quote = 0;
+    for (; *ptr; ptr++) {
+        if (quote == '\'') {
+            if (*ptr == '\'') {
+                quote = 0;
+            }
+        } else if (*ptr == '\\' && ptr[1]) {
+            ptr++;
+        } else if (quote) {
+            if (*ptr == '"') {
+                quote = 0;
+            }
+        } else if (*ptr == '\'' || *ptr == '"') {
+            quote = *ptr;
+        } else if (*ptr == '(') {
+            depth++;
+        } else if (*ptr == ')' && --depth == 0) {
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+/* Makes room at the end of text being built in the line arena
+* Inputs:
+*   text -- The text
+*   used -- Characters in the text so far
+*   cap -- The size of the text, updated if it grows
+*   more -- Characters about to be added
+*
+* Outputs:
+*   char* -- The text, which may have moved
+*/
+char* reserveText(char* text, size_t used, size_t* cap, size_t more) {
+    if (used + more <= *cap) {
+        return text;
+    }
+    size_t newCap = *cap * 2 > used + more ? *cap * 2 : used + more;
+    text = arenaGrow(text, *cap, newCap);
+    *cap = newCap;
+    return text;
+}
+
+/* Runs a command substitution and reads its output
+*  - The command runs in a forked copy of the shell, so builtins and pipelines work, with its output in a pipe
+*  - The shell reads the pipe with large non-blocking reads straight into the buffer, so no temporary file is used
+*
+* Inputs:
+*   text -- The command
+*   jobs -- The table that holds all background process information
+*   buf -- Set to the output
+*
+* Outputs:
+*   int -- 1 if the command ran; 0 if it could not be started
+*/
+int captureCmd(char* text, jobTable* jobs, captureBuffer* buf) {
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) < 0) {
+        printf("Cannot run $(%s): %s\n", text, strerror(errno));
+        return 0;
+    }
+    // Anything the shell has not printed yet would be printed again by the copy
+    fflush(stdout);
+    int pid = fork();
+    if (pid == 0) {
+        // Run the command with its output in the pipe, without the process messages
+        dup2(pipeFds[1], 1);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        quietJobs = 1;
+        runLine(text, jobs);
+        fflush(stdout);
+        _exit(0);
+    }
+    close(pipeFds[1]);
+    if (pid < 0) {
+        printf("Cannot run $(%s): %s\n", text, strerror(errno));
+        close(pipeFds[0]);
+        return 0;
+    }
+
+    // Read until every writer has closed the pipe
+    fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+    struct pollfd readable = {pipeFds[0], POLLIN, 0};
+    buf->used = 0;
+    while (buf->size - buf->used >= PUMP_CHUNK || growCapture(buf)) {
+        ssize_t n = read(pipeFds[0], buf->data + buf->used, buf->size - buf->used);
+        if (n > 0) {
+            buf->used += n;
+        } else if (n == 0) {
+            break;
+        } else if (errno == EAGAIN) {
+            poll(&readable, 1, -1);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    close(pipeFds[0]);
+    waitpid(pid, NULL, 0);
+    return 1;
+}
+
+/* Doubles a command substitution buffer
+* Inputs:
+*   buf -- The buffer, which may have no memory yet
+*
+* Outputs:
+*   int -- 1 if it grew; 0 if there is no more memory, leaving it as it was
+*/
+int growCapture(captureBuffer* buf) {
+    size_t size = buf->size > 0 ? buf->size * 2 : PUMP_CHUNK * 2;
+    char* data;
+    if (buf->data == NULL) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        data = mremap(buf->data, buf->size, size, MREMAP_MAYMOVE);
+    }
+    if (data == MAP_FAILED) {
+        printf("Command output too large: %s\n", strerror(errno));
+        return 0;
+    }
+    buf->data = data;
+    buf->size = size;
+    return 1;
+}
+
+/* Takes a command substitution buffer from the pool, or makes a new one if it is empty
+* Outputs:
+*   captureBuffer* -- The buffer
+*/
+captureBuffer* getCapture() {
+    if (numPooled > 0) {
+        return capturePool[--numPooled];
+    }
+    return calloc(1, sizeof(captureBuffer));
+}
+
+/* Gives a command substitution buffer back to the pool
+*  - Buffers over CAPTURE_KEEP are shrunk back to it, and buffers that do not fit in the pool are unmapped
+*
+* Inputs:
+*   buf -- The buffer
+*/
+void putCapture(captureBuffer* buf) {
+    if (numPooled == CAPTURE_POOL) {
+        if (buf->data != NULL) {
+            munmap(buf->data, buf->size);
+        }
+        free(buf);
+        return;
+    }
+    if (buf->size > CAPTURE_KEEP) {
+        char* data = mremap(buf->data, buf->size, CAPTURE_KEEP, 0);
+        if (data != MAP_FAILED) {
+            buf->data = data;
+            buf->size = CAPTURE_KEEP;
+        }
+    }
+    capturePool[numPooled++] = buf;
+}
+
+/* Checks if a word is an unquoted operator
+* Inputs:
+*   word -- The word, from tokenize
+*
+* Outputs:
+*   int -- 1 if it is |, <, >, >> or & from the operators table; 0 if it is an ordinary word
+*/
+int isOperator(char* word) {
+    int i;
+    for (i = 0; i < 5; i++) {
+        if (word == operators[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Hands out memory from the line arena
+*  - Moves on to the next block, or adds one, when the current block is full
+*
+* Inputs:
+*   size -- The number of bytes
+*
+* Outputs:
+*   void* -- The memory, 16 byte aligned, valid until the next arenaReset
+*/
+void* arenaAlloc(size_t size) {
+    size = (size + 15) & ~(size_t) 15;
+    // Find a block with room, starting with the current one
+    while (arenaCurrent != NULL && arenaCurrent->size - arenaCurrent->used < size) {
+        if (arenaCurrent->next == NULL || arenaCurrent->next->size < size) {
+            // Add a block big enough after the current one
+            size_t blockSize = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+            arenaBlock* block = malloc(sizeof(arenaBlock) + blockSize);
+            block->size = blockSize;
+            block->used = 0;
+            block->next = arenaCurrent->next;
+            arenaCurrent->next = block;
+        }
+        arenaCurrent = arenaCurrent->next;
+    }
+    // The first block
+    if (arenaCurrent == NULL) {
+        size_t blockSize = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        arenaFirst = arenaCurrent = malloc(sizeof(arenaBlock) + blockSize);
+        arenaFirst->size = blockSize;
+        arenaFirst->used = 0;
+        arenaFirst->next = NULL;
+    }
+    void* mem = arenaCurrent->data + arenaCurrent->used;
+    arenaCurrent->used += size;
+    return mem;
+}
+
+/* Grows memory from the line arena
+*  - The last memory handed out grows in place if its block has room, anything else is copied
+*
+* Inputs:
+*   mem -- The memory, from arenaAlloc
+*   oldSize -- The size it was allocated with
+*   newSize -- The size it needs
+*
+* Outputs:
+*   void* -- The memory, which may have moved
+*/
+void* arenaGrow(void* mem, size_t oldSize, size_t newSize) {
+    oldSize = (oldSize + 15) & ~(size_t) 15;
+    newSize = (newSize + 15) & ~(size_t) 15;
+    if ((char*) mem + oldSize == arenaCurrent->data + arenaCurrent->used && arenaCurrent->size - arenaCurrent->used >= newSize - oldSize) {
+        arenaCurrent->used += newSize - oldSize;
+        return mem;
+    }
+    void* newMem = arenaAlloc(newSize);
+    memcpy(newMem, mem, oldSize);
+    return newMem;
+}
+
+/* Gives back everything handed out by the line arena, keeping the blocks for the next line
+*/
+void arenaReset() {
+    arenaBlock* block;
+    for (block = arenaFirst; block != NULL; block = block->next) {
+        block->used = 0;
+    }
+    arenaCurrent = arenaFirst;
+}
+
+/* Checks if any background processes have finished
+*  - Reaps every child that has exited, so none are left as zombies
+*  - Children the table does not know about, like ones already reported as killed, are reaped silently
+*
+* Inputs:
+*   jobs -- The table that holds all background process information
+*/
+void checkBgProcesses(jobTable* jobs) {
+    // Empty childFd - one read can stand for several children, so the reaping below does not rely on the count
+    struct signalfd_siginfo info[16];
+    while (read(childFd, info, sizeof(info)) > 0);
+
+    // Check if there were any background processes & if they finished
+    int status;
+    struct rusage usage;
+    int backgroundPID = wait4(-1, &status, WNOHANG, &usage);
+    while (backgroundPID > 0) {
+        // Find the process that this ID is associated with
+        bgProcess* proc = findBgProcess(jobs, backgroundPID);
+        if (proc != NULL) {
+            // Print the background processes status, with the wall time of a parallel command
+            reportProcess(jobs, backgroundPID, status, proc->cmd, &proc->start, proc->parallel, &usage);
+            // Clean up the process in the table
+            removeBgProcess(jobs, proc);
+        }
+        // Check for a new backgroundPID
+        backgroundPID = wait4(-1, &status, WNOHANG, &usage);
+    }
+}
+
+/* Waits until a whole line of input is read, reaping background processes the moment they finish
+*  - The prompt is printed again after any status messages
+*  - The input is read into the shell's own buffer, so a line already read is seen without polling
+*
+* Inputs:
+*   jobs -- The table that holds all background process information
+*   userPrompt -- The user prompt
+*/
+void waitForInput(jobTable* jobs, char* userPrompt) {
+    fflush(stdout);
+    while (!inputEnded && memchr(inputBuf + inputPos, '\n', inputLen - inputPos) == NULL) {
+        struct pollfd fds[2] = {{inputFd, POLLIN, 0}, {childFd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            continue;
+        }
+        // Reap the children that exited
+        if (fds[1].revents & POLLIN) {
+            int before = jobs->numJobs;
+            checkBgProcesses(jobs);
+            if (jobs->numJobs != before) {
+                printf("%s", userPrompt);
+                fflush(stdout);
+            }
+        }
+        // Read what has arrived - a partial line keeps waiting for the rest
+        if (fds[0].revents) {
+            fillInput();
+        }
+    }
+}
+
+/* Reads what is waiting on inputFd into the input buffer
+*  - The unread part is moved to the front first, and the buffer doubles when it is still full
+*  - Sets inputEnded at the end of the input or on an error
+*/
+void fillInput() {
+    if (inputPos > 0) {
+        memmove(inputBuf, inputBuf + inputPos, inputLen - inputPos);
+        inputLen -= inputPos;
+        inputPos = 0;
+    }
+    // Always keep a byte free to end the last line
+    if (inputCap - inputLen < INPUT_CHUNK) {
+        inputCap *= 2;
+        inputBuf = realloc(inputBuf, inputCap);
+    }
+    ssize_t got;
+    do {
+        got = read(inputFd, inputBuf + inputLen, inputCap - inputLen - 1);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+        inputEnded = 1;
+        return;
+    }
+    inputLen += got;
+}
+
+/* Takes the next line from the input buffer, after waitForInput
+*  - The line is ended in place and stays valid until the next fillInput
+*  - A last line with no newline is still returned
+*
+* Outputs:
+*   char* -- The line, without its newline; NULL at the end of the input
+*/
+char* readLine() {
+    char* line = inputBuf + inputPos;
+    char* newline = memchr(line, '\n', inputLen - inputPos);
+    if (newline == NULL) {
+        // The last line, at the end of the input
+        if (inputPos == inputLen) {
+            return NULL;
+        }
+        inputBuf[inputLen] = 0;
+        inputPos = inputLen;
+        return line;
+    }
+    *newline = 0;
+    inputPos = newline - inputBuf + 1;
+    return line;
+}
+
+/* Waits for commands started by the parallel scheduler until enough slots are free
+*  - Background processes that finish meanwhile are reaped and reported too
+*
+* Inputs:
+*   jobs -- The table that holds all background process information
+*   slots -- The number of slots that must be free, maxParallel to wait for every parallel command
+*/
+void waitForSlots(jobTable* jobs, int slots) {
+    while (jobs->numParallel > maxParallel - slots) {
+        // Sleep until a child exits, then reap it
+        struct pollfd fds = {childFd, POLLIN, 0};
+        poll(&fds, 1, -1);
+        checkBgProcesses(jobs);
+    }
+}
+
+/* Prints the status of a reaped process and keeps it for jobs in timing mode
+* Inputs:
+*   jobs -- The table that holds all background process information
+*   pid -- The PID of the process that has exited
+*   status -- The status of the process that has exited
+*   cmd -- The command ran for the process that has exited
+*   start -- When the process started
+*   detail -- What to print outside timing mode: 0 for the status, 1 to add the wall time, 2 to add the usage too
+*   usage -- The resources the process used, from wait4
+*/
+void reportProcess(jobTable* jobs, int pid, int status, char* cmd, struct timespec* start, int detail, struct rusage* usage) {
+    // Timing mode always prints everything
+    if (timingMode) {
+        detail = 2;
+    }
+    double wallTime = secondsSince(start);
+    if (!quietJobs) {
+        printStatus(pid, status, cmd, detail > 0 ? wallTime : -1, detail > 1 ? usage : NULL);
+    }
+
+    // Keep it in timing mode, replacing the oldest one kept
+    if (timingMode) {
+        finishedProcess* done = &jobs->finished[jobs->numFinished++ % FINISHED_JOBS];
+        if (jobs->numFinished > FINISHED_JOBS) {
+            free(done->cmd);
+        }
+        done->cmd = strdup(cmd);
+        done->PID = pid;
+        done->status = status;
+        done->wallTime = wallTime;
+        done->usage = *usage;
+    }
+}
+
+/* Prints the status message of a command
+*  - With no command, prints only the times and usage, for a process that is still running
+*
+* Inputs:
+*   pid -- The PID of the process that has exited
+*   status -- The status of the process that has exited
+*   cmd -- The command ran for the process that has exited, NULL to leave out the status
+*   wallTime -- Seconds the process ran for, printed after the status, less than 0 to leave out
+*   usage -- The resources the process used, printed after the wall time, NULL to leave out
+*/
+void printStatus(int pid, int status, char* cmd, double wallTime, struct rusage* usage) {
+    // Print the child's process ID & the command that was attempted to be run & exit status
+    if (cmd == NULL) {
+        // Nothing to print before the times
+    } else if (WIFEXITED(status)) {
+        printf("[%d] %s Exit %d", pid, cmd, WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        printf("[%d] %s Exit %d", pid, cmd, WTERMSIG(status));
+    } else if (status == -1) {
+        printf("[%d] %s Exit %d", pid, cmd, 255);
+    } else {
+        return;
+    }
+    // Print how long it ran and what it used
+    if (usage != NULL) {
+        printf(" (real %.3fs user %ld.%03lds sys %ld.%03lds maxrss %ldKB ctxsw %ld/%ld)", wallTime,
+            usage->ru_utime.tv_sec, usage->ru_utime.tv_usec / 1000, usage->ru_stime.tv_sec, usage->ru_stime.tv_usec / 1000,
+            usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+    } else if (wallTime >= 0) {
+        printf(" (%.3fs)", wallTime);
+    }
+    printf("\n");
+}
+
+/* Reads the resources a running process has used so far from /proc
+* Inputs:
+*   pid -- The PID of the process
+*   usage -- Set to the user and sys time, max RSS and context switches; other fields are zeroed
+*
+* Outputs:
+*   int -- 1 if the usage was read; 0 if the process is gone
+*/
+int readProcUsage(int pid, struct rusage* usage) {
+    memset(usage, 0, sizeof(*usage));
+    char path[64], line[512];
+
+    // Get the user and sys time, in clock ticks, from fields 14 and 15 of stat - the name before them can hold spaces
+    sprintf(path, "/proc/%d/stat", pid);
+    FILE* stat = fopen(path, "r");
+    if (stat == NULL) {
+        return 0;
+    }
+    unsigned long utime = 0, stime = 0;
+    if (fgets(line, sizeof(line), stat) != NULL && strrchr(line, ')') != NULL) {
+        sscanf(strrchr(line, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    }
+    fclose(stat);
+    long ticks = sysconf(_SC_CLK_TCK);
+    usage->ru_utime.tv_sec = utime / ticks;
+    usage->ru_utime.tv_usec = utime % ticks * 1000000 / ticks;
+    usage->ru_stime.tv_sec = stime / ticks;
+    usage->ru_stime.tv_usec = stime % ticks * 1000000 / ticks;
+
+    // Get the max RSS and context switches from status
+    sprintf(path, "/proc/%d/status", pid);
+    FILE* status = fopen(path, "r");
+    if (status == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), status) != NULL) {
+        sscanf(line, "VmHWM: %ld", &usage->ru_maxrss);
+        sscanf(line, "voluntary_ctxt_switches: %ld", &usage->ru_nvcsw);
+        sscanf(line, "nonvoluntary_ctxt_switches: %ld", &usage->ru_nivcsw);
+    }
+    fclose(status);
+    return 1;
+}
+
+/* Returns the time since a moment
+* Inputs:
+*   start -- The moment, from CLOCK_MONOTONIC
+*
+* Outputs:
+*   double -- The seconds since then
+*/
+double secondsSince(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Adds a background process to the table
+*  - The table doubles its buckets once it holds twice as many processes, so lookups stay constant time
+*
+* Inputs:
+*   jobs -- The table that holds all background process information
+*   pid -- The PID of the background process
+*   cmd -- The command ran for the background process
+*   parallel -- 1 if the process was started by the parallel scheduler; 0 if it was started with &
+*   settings -- The launch settings it was started with, NULL for none
+*
+* Outputs:
+*   bgProcess* -- The new entry in the table
+*/
+bgProcess* addBgProcess(jobTable* jobs, int pid, char* cmd, int parallel, char* settings) {
+    // Grow the table, moving every process into its new bucket
+    if (jobs->numJobs >= jobs->numBuckets * 2) {
+        int newSize = jobs->numBuckets * 2;
+        bgProcess** newBuckets = calloc(newSize, sizeof(bgProcess*));
+        bgProcess* proc;
+        for (proc = jobs->first; proc != NULL; proc = proc->nextJob) {
+            proc->next = newBuckets[proc->PID & (newSize - 1)];
+            newBuckets[proc->PID & (newSize - 1)] = proc;
+        }
+        free(jobs->buckets);
+        jobs->buckets = newBuckets;
+        jobs->numBuckets = newSize;
+    }
+
+    // Assign struct values
+    bgProcess* proc = malloc(sizeof(bgProcess));
+    proc->PID = pid;
+    proc->cmd = strdup(cmd);
+    proc->parallel = parallel;
+    proc->settings = settings != NULL ? strdup(settings) : NULL;
+    clock_gettime(CLOCK_MONOTONIC, &proc->start);
+    jobs->numParallel += parallel;
+
+    // Add it to its bucket and to the end of the start order
+    int bucket = pid & (jobs->numBuckets - 1);
+    proc->next = jobs->buckets[bucket];
+    jobs->buckets[bucket] = proc;
+    proc->prevJob = jobs->last;
+    proc->nextJob = NULL;
+    if (jobs->last != NULL) {
+        jobs->last->nextJob = proc;
+    } else {
+        jobs->first = proc;
+    }
+    jobs->last = proc;
+    jobs->numJobs++;
+    return proc;
+}
+
+/* Finds a background process by PID
+* Inputs:
+*   jobs -- The table that holds all background process information
+*   pid -- The PID to look for
+*
+* Outputs:
+*   bgProcess* -- The background process; NULL if there is none with that PID
+*/
+bgProcess* findBgProcess(jobTable* jobs, int pid) {
+    bgProcess* proc = jobs->buckets[pid & (jobs->numBuckets - 1)];
+    while (proc != NULL && proc->PID != pid) {
+        proc = proc->next;
+    }
+    return proc;
+}
+
+/* Removes a background process from the table
+* Inputs:
+*   jobs -- The table that holds all background process information
+*   proc -- The background process to remove
+*/
+void removeBgProcess(jobTable* jobs, bgProcess* proc) {
+    // Unlink it from its bucket
+    bgProcess** link = &jobs->buckets[proc->PID & (jobs->numBuckets - 1)];
+    while (*link != proc) {
+        link = &(*link)->next;
+    }
+    *link = proc->next;
+
+    // Unlink it from the start order
+    if (proc->prevJob != NULL) {
+        proc->prevJob->nextJob = proc->nextJob;
+    } else {
+        jobs->first = proc->nextJob;
+    }
+    if (proc->nextJob != NULL) {
+        proc->nextJob->prevJob = proc->prevJob;
+    } else {
+        jobs->last = proc->prevJob;
+    }
+
+    // Free it & decrement total processes
+    jobs->numJobs--;
+    jobs->numParallel -= proc->parallel;
+    free(proc->cmd);
+    free(proc->settings);
+    free(proc);
+}
+
+/* Starts a program command in a new process
+*  - The program is found through the PATH table, so PATH is only searched the first time a command runs
+*  - posix_spawn reports exec failures itself
+*  - vfork and fork report them over a close-on-exec pipe, which the child only writes to if the exec fails
+*  - A command that fails to exec is dropped from the PATH table, so the next run searches PATH again
+*  - A launch setting the child cannot apply is reported over the same pipe, and leaves the PATH table alone
+*  - posix_spawn cannot apply launch settings, so a command with any is started with vfork instead
+*
+* Inputs:
+*   cmd -- The name or path of the program
+*   cmdArgs -- The NULL terminated arguments, starting with cmd
+*   inFd -- The file the program reads from, 0 to share the shell's
+*   outFd -- The file the program writes to, 1 to share the shell's
+*   settings -- The launch settings, applied in the child before the exec, NULL for none - failed is set to the
+*               setting that could not be applied, or 0
+*
+* Outputs:
+*   int -- The PID of the new process; -1 with errno set if it could not be started
+*/
+int launchCmd(char* cmd, char* cmdArgs[], int inFd, int outFd, launchSettings* settings) {
+    int pid, err = 0;
+    if (settings != NULL) {
+        settings->failed = 0;
+    }
+
+    // Find the program
+    char* path = findCmd(cmd, 1);
+    if (path == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    // Spawn the command
+    if (launchMode == LAUNCH_SPAWN && settings == NULL) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        // Children start with SIGCHLD unblocked
+        posix_spawnattr_t attr;
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigmask(&attr, &noSignals);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+        if (inFd != 0) {
+            posix_spawn_file_actions_adddup2(&actions, inFd, 0);
+        }
+        if (outFd != 1) {
+            posix_spawn_file_actions_adddup2(&actions, outFd, 1);
+        }
+        err = posix_spawn(&pid, path, &actions, &attr, cmdArgs, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        if (err) {
+            forgetCmd(cmd);
+        }
+        errno = err;
+        return err ? -1 : pid;
+    }
+
+    // Create the pipe - both ends close when the child execs, like every file the shell opens
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    // Fork so that another process will run the command
+    if (launchMode != LAUNCH_FORK) {
+        pid = vfork();
+    } else {
+        pid = fork();
+    }
+    if (pid == 0) {
+        // Connect the input and output
+        if (inFd != 0) {
+            dup2(inFd, 0);
+        }
+        if (outFd != 1) {
+            dup2(outFd, 1);
+        }
+        // Children start with SIGCHLD unblocked
+        sigprocmask(SIG_UNBLOCK, &childMask, NULL);
+        // Apply the settings, then execute the command - it only returns if the exec failed, so send the error to the shell
+        //  - The report is the error, then the setting that failed or 0 if the exec did
+        int report[2] = {0, settings != NULL ? applySettings(settings) : 0};
+        if (report[1] == 0) {
+            execv(path, cmdArgs);
+        }
+        report[0] = errno;
+        write(p[1], report, sizeof(report));
+        _exit(127);
+    }
+    if (pid < 0) {
+        err = errno;
+    }
+
+    // Read the error report - the read ends with nothing once the exec succeeds
+    close(p[1]);
+    int report[2];
+    if (pid > 0 && read(p[0], report, sizeof(report)) == sizeof(report)) {
+        // Clean up the child that failed, forgetting the command only if the exec itself did
+        waitpid(pid, NULL, 0);
+        err = report[0];
+        if (report[1]) {
+            settings->failed = report[1];
+        } else {
+            forgetCmd(cmd);
+        }
+        pid = -1;
+    }
+    close(p[0]);
+    errno = err;
+    return pid;
+}
+
+/* Finds the full path of a command
+*  - Names with a slash are used as they are
+*  - Other names are looked up in the PATH table, and PATH is searched only if they are not there
+*  - The table is cleared first if PATH changed since it was filled
+*
+* Inputs:
+*   cmd -- The name of the command
+*   remember -- 1 if this lookup is for a run and counts as a hit; 0 to only fill the table
+*
+* Outputs:
+*   char* -- The full path of the command; NULL if it is not on PATH
+*/
+char* findCmd(char* cmd, int remember) {
+    // Clear the table if PATH changed
+    char* envPath = getenv("PATH");
+    if (envPath == NULL) {
+        envPath = "/usr/local/bin:/usr/bin:/bin";
+    }
+    if (pathTablePath == NULL || strcmp(pathTablePath, envPath)) {
+        clearPathTable();
+        pathTablePath = strdup(envPath);
+    }
+
+    // Names with a slash are not searched for
+    if (strchr(cmd, '/') != NULL) {
+        return cmd;
+    }
+    if (!strcmp(cmd, "")) {
+        return NULL;
+    }
+
+    // Check the table
+    unsigned int bucket = hashName(cmd) % PATH_BUCKETS;
+    pathEntry* entry;
+    for (entry = pathTable[bucket]; entry != NULL; entry = entry->next) {
+        if (!strcmp(entry->name, cmd)) {
+            entry->hits += remember;
+            return entry->path;
+        }
+    }
+
+    // Search each directory on PATH for a regular file that can be executed
+    char* dirs = strdup(envPath);
+    char* dirStart = dirs;
+    char* path = NULL;
+    while (dirStart != NULL && path == NULL) {
+        // Split off the next directory - an empty one means the current directory
+        char* dirEnd = strchr(dirStart, ':');
+        if (dirEnd != NULL) {
+            *dirEnd = 0;
+        }
+        char* dir = strcmp(dirStart, "") ? dirStart : ".";
+        // Check the command in that directory
+        char* candidate = malloc(strlen(dir) + strlen(cmd) + 2);
+        sprintf(candidate, "%s/%s", dir, cmd);
+        struct stat info;
+        if (stat(candidate, &info) == 0 && S_ISREG(info.st_mode) && access(candidate, X_OK) == 0) {
+            path = candidate;
+        } else {
+            free(candidate);
+        }
+        dirStart = dirEnd != NULL ? dirEnd + 1 : NULL;
+    }
+    free(dirs);
+    if (path == NULL) {
+        return NULL;
+    }
+
+    // Remember where it was found, in later sessions too
+    entry = malloc(sizeof(pathEntry));
+    entry->name = strdup(cmd);
+    entry->path = path;
+    entry->hits = remember;
+    entry->next = pathTable[bucket];
+    pathTable[bucket] = entry;
+    appendSession(SESSION_PATH, hashName(envPath), cmd, path);
+    return path;
+}
+
+/* Drops a command from the PATH table
+* Inputs:
+*   cmd -- The name of the command
+*/
+void forgetCmd(char* cmd) {
+    appendSession(SESSION_PATH, pathTablePath != NULL ? hashName(pathTablePath) : 0, cmd, "");
+    pathEntry** link = &pathTable[hashName(cmd) % PATH_BUCKETS];
+    while (*link != NULL) {
+        if (!strcmp((*link)->name, cmd)) {
+            pathEntry* entry = *link;
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+/* Drops every command from the PATH table
+*/
+void clearPathTable() {
+    int i;
+    for (i = 0; i < PATH_BUCKETS; i++) {
+        while (pathTable[i] != NULL) {
+            pathEntry* entry = pathTable[i];
+            pathTable[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+    }
+}
+
+/* Hashes a command name for the PATH table
+* Inputs:
+*   name -- The name of the command
+*
+* Outputs:
+*   unsigned int -- The FNV-1a hash of the name
+*/
+unsigned int hashName(char* name) {
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (unsigned char) *name++) * 16777619u;
+    }
+    return hash;
+}
+
+/* Adds a command location from the session file to the PATH table, replacing any it has
+* Inputs:
+*   cmd -- The name of the command
+*   path -- Where it was found
+*/
+void seedCmd(char* cmd, char* path) {
+    unsigned int bucket = hashName(cmd) % PATH_BUCKETS;
+    pathEntry* entry;
+    for (entry = pathTable[bucket]; entry != NULL; entry = entry->next) {
+        if (!strcmp(entry->name, cmd)) {
+            if (strcmp(entry->path, path)) {
+                free(entry->path);
+                entry->path = strdup(path);
+            }
+            return;
+        }
+    }
+    entry = malloc(sizeof(pathEntry));
+    entry->name = strdup(cmd);
+    entry->path = strdup(path);
+    entry->hits = 0;
+    entry->next = pathTable[bucket];
+    pathTable[bucket] = entry;
+}
+
+/* Opens the session file and reads it
+*  - A new file is made with just a header
+*  - History lines are indexed by their offsets, not copied, and command locations for the current PATH are added
+*    to the PATH table, so loading is one pass over the mapped file and one sort
+*  - If the file cannot be used the shell runs without one
+*
+* Inputs:
+*   fileName -- The session file
+*/
+void openSession(char* fileName) {
+    int fd = open(fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    struct stat info;
+    if (fstat(fd, &info) < 0 || (info.st_size == 0 && ftruncate(fd, SESSION_GROW) < 0)) {
+        close(fd); // Closing it drops the lock
+        return;
+    }
+    session.fd = fd;
+    if (!mapSession()) {
+        close(fd);
+        session.fd = -1;
+        return;
+    }
+
+    // Write the header of a new file, and check the header of an old one
+    sessionHeader* header = (sessionHeader*) session.map;
+    if (info.st_size == 0) {
+        memcpy(header->magic, SESSION_MAGIC, sizeof(header->magic));
+        header->used = sizeof(sessionHeader);
+    }
+    if (memcmp(header->magic, SESSION_MAGIC, sizeof(header->magic)) || header->used < sizeof(sessionHeader)) {
+        printf("%s is not a session file\n", fileName);
+        munmap(session.map, session.mapSize);
+        flock(fd, LOCK_UN);
+        close(fd);
+        session.fd = -1;
+        return;
+    }
+
+    // Read the records, then sort the history once instead of inserting each line in order
+    findCmd("", 0); // Sets the PATH the table is for
+    session.loaded = sizeof(sessionHeader);
+    session.replaying = 1;
+    catchUpSession();
+    session.replaying = 0;
+    qsort(session.index, session.indexSize, sizeof(historyEntry), compareHistory);
+    // Keep only the most recent of each line, which sorts last
+    int i, kept = 0;
+    for (i = 0; i < session.indexSize; i++) {
+        if (kept > 0 && !strcmp(historyText(session.index[kept - 1].offset), historyText(session.index[i].offset))) {
+            kept--;
+        }
+        session.index[kept++] = session.index[i];
+    }
+    session.indexSize = kept;
+    session.sorted = 1;
+    flock(fd, LOCK_UN);
+}
+
+/* Maps the whole session file, mapping it again if it grew
+* Outputs:
+*   int -- 1 if it is mapped; 0 if it could not be
+*/
+int mapSession() {
+    struct stat info;
+    if (fstat(session.fd, &info) < 0) {
+        return 0;
+    }
+    if (info.st_size == session.mapSize) {
+        return 1;
+    }
+    char* map;
+    if (session.map == NULL) {
+        map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, session.fd, 0);
+    } else {
+        map = mremap(session.map, session.mapSize, info.st_size, MREMAP_MAYMOVE);
+    }
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    session.map = map;
+    session.mapSize = info.st_size;
+    return 1;
+}
+
+/* Reads the records added to the session file since it was last read, by this shell or another one
+*  - Reading stops at a record that does not fit, so a damaged file loses only its end
+*/
+void catchUpSession() {
+    sessionHeader* header = (sessionHeader*) session.map;
+    if (header->used > session.mapSize && (!mapSession() || header->used > session.mapSize)) {
+        return;
+    }
+    header = (sessionHeader*) session.map;
+    int wasReplaying = session.replaying;
+    session.replaying = 1;
+    while (session.loaded + sizeof(sessionRecord) <= header->used) {
+        sessionRecord* rec = (sessionRecord*) (session.map + session.loaded);
+        if (rec->size < sizeof(sessionRecord) || rec->size % 8 || rec->size > header->used - session.loaded) {
+            break;
+        }
+        applyRecord(rec, session.loaded);
+        session.loaded += rec->size;
+    }
+    session.replaying = wasReplaying;
+}
+
+/* Does what a session file record says
+* Inputs:
+*   rec -- The record
+*   offset -- Where it is in the file
+*/
+void applyRecord(sessionRecord* rec, size_t offset) {
+    if (rec->type == SESSION_HISTORY) {
+        indexHistory(offset, ++session.numHistory);
+    } else if (rec->type == SESSION_PATH && pathTablePath != NULL && rec->pathHash == hashName(pathTablePath)) {
+        // Locations found on another PATH do not apply
+        char* path = rec->text + strlen(rec->text) + 1;
+        if (*path) {
+            seedCmd(rec->text, path);
+        } else {
+            forgetCmd(rec->text);
+        }
+    } else if (rec->type == SESSION_CLEAR) {
+        clearPathTable();
+    }
+}
+
+/* Appends a record to the session file
+*  - The record is written before the header counts it, so a shell that dies part way leaves no partial record
+*  - The file grows by doubling, and is mapped again when it does
+*
+* Inputs:
+*   type -- One of the SESSION_* record types
+*   pathHash -- For a command location, hashName of the PATH it was found on
+*   text -- The line, or the name of the command
+*   path -- Where the command was found, "" to forget it, or NULL for a record with only text
+*/
+void appendSession(int type, unsigned int pathHash, char* text, char* path) {
+    if (session.fd < 0 || session.replaying) {
+        return;
+    }
+    size_t textLen = strlen(text) + 1, pathLen = path != NULL ? strlen(path) + 1 : 0;
+    size_t size = (sizeof(sessionRecord) + textLen + pathLen + 7) & ~(size_t) 7;
+
+    flock(session.fd, LOCK_EX);
+    // Read what other shells added, so the record goes after theirs
+    catchUpSession();
+    sessionHeader* header = (sessionHeader*) session.map;
+    if (header->used + size > session.mapSize) {
+        size_t fileSize = session.mapSize * 2;
+        while (fileSize < header->used + size) {
+            fileSize *= 2;
+        }
+        if (ftruncate(session.fd, fileSize) < 0 || !mapSession()) {
+            flock(session.fd, LOCK_UN);
+            return;
+        }
+        header = (sessionHeader*) session.map;
+    }
+
+    // Write the record, then count it
+    sessionRecord* rec = (sessionRecord*) (session.map + header->used);
+    memset(rec, 0, size);
+    rec->size = size;
+    rec->type = type;
+    rec->pathHash = pathHash;
+    memcpy(rec->text, text, textLen);
+    if (path != NULL) {
+        memcpy(rec->text + textLen, path, pathLen);
+    }
+    header->used += size;
+    catchUpSession();
+    flock(session.fd, LOCK_UN);
+}
+
+/* Adds a history line to the prefix index
+*  - While the file is being opened lines are only added to the end, and sorted once it is read
+*  - After that each line is put in its place, or replaces the same line entered before
+*
+* Inputs:
+*   offset -- Where its record is in the file
+*   number -- Its history number
+*/
+void indexHistory(size_t offset, int number) {
+    historyEntry entry = {offset, number};
+    if (session.indexSize == session.indexCap) {
+        session.indexCap = session.indexCap > 0 ? session.indexCap * 2 : 256;
+        session.index = realloc(session.index, session.indexCap * sizeof(historyEntry));
+    }
+    if (!session.sorted) {
+        session.index[session.indexSize++] = entry;
+        return;
+    }
+
+    // Binary search for where the line goes
+    char* text = historyText(offset);
+    int lo = 0, hi = session.indexSize;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(historyText(session.index[mid].offset), text);
+        if (cmp == 0) {
+            session.index[mid] = entry;
+            return;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    memmove(session.index + lo + 1, session.index + lo, (session.indexSize - lo) * sizeof(historyEntry));
+    session.index[lo] = entry;
+    session.indexSize++;
+}
+
+/* Compares two history lines for qsort, by text then by history number
+* Inputs:
+*   a -- The first historyEntry
+*   b -- The second historyEntry
+*
+* Outputs:
+*   int -- Less than, equal to or greater than 0 as a sorts before, with or after b
+*/
+int compareHistory(const void* a, const void* b) {
+    const historyEntry* x = a, * y = b;
+    int cmp = strcmp(historyText(x->offset), historyText(y->offset));
+    return cmp != 0 ? cmp : x->number - y->number;
+}
+
+/* Finds the text of a history line
+* Inputs:
+*   offset -- Where its record is in the file
+*
+* Outputs:
+*   char* -- The line, in the mapped file
+*/
+char* historyText(size_t offset) {
+    return ((sessionRecord*) (session.map + offset))->text;
+}
+
+/* Parses one word as a launch setting
+* Inputs:
+*   settings -- The settings to add it to
+*   word -- The word
+*
+* Outputs:
+*   int -- 1 if it was a setting; 0 if it is not one, so the command starts here; -1 if it is a setting with a bad value
+*/
+int parseSetting(launchSettings* settings, char* word) {
+    char* value = strchr(word, '=');
+    if (value == NULL) {
+        return 0;
+    }
+    value++;
+
+    if (!strncmp(word, "cpus=", 5)) {
+        // Add each CPU or range of CPUs in the list
+        settings->hasCpus = 1;
+        CPU_ZERO(&settings->cpus);
+        char* ptr = value;
+        while (*ptr) {
+            if (!isdigit(*ptr)) {
+                return -1;
+            }
+            int lo = strtol(ptr, &ptr, 10), hi = lo;
+            if (*ptr == '-') {
+                hi = strtol(ptr + 1, &ptr, 10);
+            }
+            if (hi < lo || hi >= CPU_SETSIZE || (*ptr && *ptr != ',')) {
+                return -1;
+            }
+            for (; lo <= hi; lo++) {
+                CPU_SET(lo, &settings->cpus);
+            }
+            ptr += *ptr == ',';
+        }
+        return CPU_COUNT(&settings->cpus) > 0 ? 1 : -1;
+    } else if (!strncmp(word, "nice=", 5)) {
+        char* end;
+        settings->hasNice = 1;
+        settings->nice = strtol(value, &end, 10);
+        return *value && !*end ? 1 : -1;
+    } else if (!strncmp(word, "ionice=", 7)) {
+        // The class goes in the top bits, the level in the bottom ones
+        int ioClass, level = 4;
+        char* colon = strchr(value, ':');
+        if (colon != NULL) {
+            level = atoi(colon + 1);
+            *colon = 0;
+        }
+        if (!strcmp(value, "rt")) {
+            ioClass = 1;
+        } else if (!strcmp(value, "be")) {
+            ioClass = 2;
+        } else if (!strcmp(value, "idle")) {
+            ioClass = 3;
+            level = 0;
+        } else {
+            ioClass = 0;
+        }
+        if (colon != NULL) {
+            *colon = ':';
+        }
+        settings->ioPriority = ioClass << 13 | level;
+        return ioClass && level >= 0 && level <= 7 ? 1 : -1;
+    } else if (!strncmp(word, "rlimit=", 7)) {
+        // Find the resource
+        const char* names[] = {"as", "core", "cpu", "data", "fsize", "memlock", "nofile", "nproc", "rss", "stack"};
+        const int resources[] = {RLIMIT_AS, RLIMIT_CORE, RLIMIT_CPU, RLIMIT_DATA, RLIMIT_FSIZE, RLIMIT_MEMLOCK, RLIMIT_NOFILE, RLIMIT_NPROC, RLIMIT_RSS, RLIMIT_STACK};
+        char* colon = strchr(value, ':');
+        if (colon == NULL || settings->numLimits == MAX_LIMITS) {
+            return -1;
+        }
+        int i;
+        for (i = 0; i < 10; i++) {
+            if ((int) strlen(names[i]) == colon - value && !strncmp(value, names[i], colon - value)) {
+                break;
+            }
+        }
+        // Set both the soft and hard limit, like ulimit does
+        long long limit = parseSize(colon + 1);
+        if (i == 10 || limit == -2) {
+            return -1;
+        }
+        settings->resources[settings->numLimits] = resources[i];
+        settings->limits[settings->numLimits].rlim_cur = limit < 0 ? RLIM_INFINITY : (rlim_t) limit;
+        settings->limits[settings->numLimits++].rlim_max = limit < 0 ? RLIM_INFINITY : (rlim_t) limit;
+        return 1;
+    }
+    return 0;
+}
+
+/* Parses a resource limit value
+* Inputs:
+*   value -- A number with an optional K, M or G suffix, or unlimited
+*
+* Outputs:
+*   long long -- The value; -1 for unlimited; -2 if it is not valid
+*/
+long long parseSize(char* value) {
+    if (!strcmp(value, "unlimited")) {
+        return -1;
+    }
+    char* end;
+    long long size = strtoll(value, &end, 10);
+    if (end == value || size < 0) {
+        return -2;
+    }
+    // Each suffix multiplies by 1024 and falls through to the smaller ones
+    switch (toupper(*end)) {
+        case 'G': size *= 1024;
+        case 'M': size *= 1024;
+        case 'K': size *= 1024; end++;
+        default: break;
+    }
+    return *end ? -2 : size;
+}
+
+/* Applies launch settings to the calling process
+*  - Called in the child between vfork and exec, so it only makes system calls
+*
+* Inputs:
+*   settings -- The settings
+*
+* Outputs:
+*   int -- 0 if every setting was applied; the SETTING_* that failed, with errno set, otherwise
+*/
+int applySettings(launchSettings* settings) {
+    if (settings->hasCpus && sched_setaffinity(0, sizeof(cpu_set_t), &settings->cpus) != 0) {
+        return SETTING_CPUS;
+    }
+    if (settings->hasNice && setpriority(PRIO_PROCESS, 0, settings->nice) != 0) {
+        return SETTING_NICE;
+    }
+    if (settings->ioPriority && syscall(SYS_ioprio_set, 1, 0, settings->ioPriority) != 0) {
+        return SETTING_IONICE;
+    }
+    int i;
+    for (i = 0; i < settings->numLimits; i++) {
+        if (setrlimit(settings->resources[i], &settings->limits[i]) != 0) {
+            return SETTING_RLIMIT;
+        }
+    }
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define PROMPT "308bench> " // Prompt the shell is started with, so the end of every command can be seen
+#define WARMUP 20 // Commands run before each workload is measured
+#define LONG_ARGS 4000 // Number of arguments in the long argv workload
+#define OUT_BUFFER 65536 // Bytes of shell output held while looking for the prompt
+
+// Defines a workload - one line sent to the shell over and over
+typedef struct workload {
+    char* name; // The name printed in the results
+    char* line; // The line, with no newline
+    int external; // 1 if the line starts a process, so the shell prints its PID before the prompt
+} workload;
+
+// Holds the shell output not yet looked at
+char outBuf[OUT_BUFFER];
+int outLen = 0;
+
+// Declare functions
+int runWorkload(char* shell, char* mode, workload* work, int count, double latencies[], double* seconds);
+int waitForPrompt(int outFd, int external);
+double elapsed(struct timespec* start);
+int compareDoubles(const void* a, const void* b);
+
+/* Benchmarks how fast 308sh starts and reaps processes
+*  - Every workload is run in a new shell for each launch strategy, with one line sent at a time
+*  - A command's latency is from sending its line until the shell prints the next prompt
+*  - The shell is run without a session file, so the benchmark does not fill the history
+*  - Prints the commands per second and the latency percentiles of each workload
+*
+* Inputs:
+*    Arg 1 -- The shell to run
+*    Arg 2 -- Commands per workload - Default is 1000
+*/
+int main(int argc, char *argv[]) {
+    // Check the arguments
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <shell> [commands]\n", argv[0]);
+        exit(1);
+    }
+    int count = argc > 2 ? atoi(argv[2]) : 1000;
+    if (count < 1) {
+        fprintf(stderr, "Commands must be positive\n");
+        exit(1);
+    }
+
+    // Build the long argv line
+    char* longLine = malloc(LONG_ARGS * 16 + 16);
+    int len = sprintf(longLine, "/bin/true");
+    int i;
+    for (i = 0; i < LONG_ARGS; i++) {
+        len += sprintf(longLine + len, " argument%d", i);
+    }
+
+    // The workloads - builtin and external versions of the same commands, background jobs, long argv and pipelines
+    workload workloads[] = {
+        {"builtin true", "true", 0},
+        {"external true", "/bin/true", 1},
+        {"builtin echo", "echo hello", 0},
+        {"external echo", "/bin/echo hello", 1},
+        {"background jobs", "/bin/true &", 1},
+        {"long argv", longLine, 1},
+        {"pipeline", "/bin/echo hello | /bin/cat | /bin/cat", 1},
+    };
+    char* modes[] = {"fork", "vfork", "spawn"};
+
+    printf("%-6s %-16s %10s %9s %9s %9s %9s\n", "launch", "workload", "cmds/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    double* latencies = malloc(count * sizeof(double));
+    int m, w;
+    for (m = 0; m < 3; m++) {
+        for (w = 0; w < sizeof(workloads) / sizeof(workload); w++) {
+            double seconds;
+            if (!runWorkload(argv[1], modes[m], &workloads[w], count, latencies, &seconds)) {
+                exit(1);
+            }
+            // Sort the latencies for the percentiles
+            qsort(latencies, count, sizeof(double), compareDoubles);
+            printf("%-6s %-16s %10.0f %9.3f %9.3f %9.3f %9.3f\n", modes[m], workloads[w].name, count / seconds,
+                latencies[(count - 1) * 50 / 100] * 1000, latencies[(count - 1) * 90 / 100] * 1000,
+                latencies[(count - 1) * 99 / 100] * 1000, latencies[count - 1] * 1000);
+            fflush(stdout);
+        }
+    }
+
+    free(latencies);
+    free(longLine);
+    return 0;
+}
+
+/* Runs a workload in a new shell
+* Inputs:
+*   shell -- The shell to run
+*   mode -- The launch strategy, passed to -l
+*   work -- The workload
+*   count -- The number of commands to time
+*   latencies -- Set to the seconds each command took
+*   seconds -- Set to the seconds all the timed commands took
+*
+* Outputs:
+*   int -- 1 if the workload ran; 0 if the shell could not be run or stopped early
+*/
+int runWorkload(char* shell, char* mode, workload* work, int count, double latencies[], double* seconds) {
+    // Start the shell with pipes for its input and output
+    int inPipe[2], outPipe[2];
+    if (pipe(inPipe) < 0 || pipe(outPipe) < 0) {
+        perror("pipe");
+        return 0;
+    }
+    int pid = fork();
+    if (pid == 0) {
+        dup2(inPipe[0], 0);
+        dup2(outPipe[1], 1);
+        close(inPipe[0]);
+        close(inPipe[1]);
+        close(outPipe[0]);
+        close(outPipe[1]);
+        execl(shell, shell, "-p", PROMPT, "-l", mode, "-s", "", (char*) NULL);
+        perror(shell);
+        _exit(1);
+    }
+    close(inPipe[0]);
+    close(outPipe[1]);
+    if (pid < 0) {
+        perror("fork");
+        return 0;
+    }
+
+    // The line with its newline
+    size_t lineLen = strlen(work->line) + 1;
+    char* line = malloc(lineLen + 1);
+    sprintf(line, "%s\n", work->line);
+
+    // Wait for the first prompt, then send the lines one at a time
+    outLen = 0;
+    int ok = waitForPrompt(outPipe[0], 0);
+    struct timespec start, sent;
+    int i;
+    for (i = 0; ok && i < WARMUP + count; i++) {
+        if (i == WARMUP) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &sent);
+        ok = write(inPipe[1], line, lineLen) == lineLen && waitForPrompt(outPipe[0], work->external);
+        if (i >= WARMUP) {
+            latencies[i - WARMUP] = elapsed(&sent);
+        }
+    }
+    *seconds = elapsed(&start);
+    if (!ok) {
+        fprintf(stderr, "%s stopped during %s with -l %s\n", shell, work->name, mode);
+    }
+
+    // Ending the input makes the shell exit
+    close(inPipe[1]);
+    close(outPipe[0]);
+    waitpid(pid, NULL, 0);
+    free(line);
+    return ok;
+}
+
+/* Reads the shell output until the prompt that follows a command
+*  - For external commands the prompt must come after a [pid] line, so a prompt the shell reprints
+*    after reaping a background job is not taken for the end of the command
+*
+* Inputs:
+*   outFd -- The shell output
+*   external -- 1 if the command starts a process
+*
+* Outputs:
+*   int -- 1 once the prompt is seen; 0 if the shell exited or could not run the command
+*/
+int waitForPrompt(int outFd, int external) {
+    int promptLen = strlen(PROMPT);
+    int sawLaunch = !external;
+    while (1) {
+        // Take prompts and whole lines off the front of the output
+        while (1) {
+            char* newline;
+            int used;
+            if (outLen >= promptLen && !memcmp(outBuf, PROMPT, promptLen)) {
+                used = promptLen;
+                if (sawLaunch) {
+                    memmove(outBuf, outBuf + used, outLen - used);
+                    outLen -= used;
+                    return 1;
+                }
+            } else if ((newline = memchr(outBuf, '\n', outLen)) != NULL) {
+                used = newline - outBuf + 1;
+                // A [pid] line without an exit status is a process being started
+                if (outBuf[0] == '[' && memmem(outBuf, used, " Exit ", 6) == NULL) {
+                    sawLaunch = 1;
+                } else if (!strncmp(outBuf, "Cannot", 6)) {
+                    fprintf(stderr, "%.*s", used, outBuf);
+                    return 0;
+                }
+            } else {
+                break;
+            }
+            memmove(outBuf, outBuf + used, outLen - used);
+            outLen -= used;
+        }
+
+        // Read more, dropping a partial line that fills the buffer
+        if (outLen == OUT_BUFFER) {
+            outLen = 0;
+        }
+        int n = read(outFd, outBuf + outLen, OUT_BUFFER - outLen);
+        if (n <= 0) {
+            return 0;
+        }
+        outLen += n;
+    }
+}
+
+/* Finds the seconds since a time
+* Inputs:
+*   start -- The time, from CLOCK_MONOTONIC
+*
+* Outputs:
+*   double -- The seconds since start
+*/
+double elapsed(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Compares two doubles for qsort
+* Inputs:
+*   a -- The first double
+*   b -- The second double
+*
+* Outputs:
+*   int -- Less than, equal to or greater than 0 as a is less than, equal to or greater than b
+*/
+int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Regression tests for 308sh
+#  - Each test runs a script through the shell with -f and checks the result
+#  - Usage: shelltest.sh <shell> - prints FAIL lines and exits 1 if any test fails
+
+SHELL_BIN=${1:-./shell}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+FAILED=0
+
+# Runs a script given on stdin through the shell, without a session file, giving up after 10 seconds
+#  - Any arguments are passed to the shell
+run() {
+    cat > "$DIR/script"
+    (cd "$DIR" && timeout 10 "$SHELL_BIN" -s "" "$@" -f script)
+}
+
+# Records a failed test
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+# A line with only redirections copies a file larger than a pipe to every output
+head -c 1000000 /dev/urandom > "$DIR/big"
+printf '< big > a > b >> c\n' | run > /dev/null || fail "< big > a > b >> c did not finish"
+for f in a b c; do
+    cmp -s "$DIR/big" "$DIR/$f" || fail "< big > a > b >> c: $f differs from big"
+done
+
+# A substitution in a comment is not run
+printf 'echo hi # $(/bin/touch pwned)\n' | run > /dev/null
+[ -e "$DIR/pwned" ] && fail "a substitution after # was run"
+
+# With -j, sleep runs alongside the other commands instead of holding up the shell
+START=$(date +%s)
+printf 'sleep 1\nsleep 1\nsleep 1\nwait\n' | run -j 3 > /dev/null
+[ $(($(date +%s) - START)) -ge 3 ] && fail "-j 3 ran three sleeps one at a time"
+
+# echo -e and printf know \xHH, and bad numbers are errors like in coreutils
+OUT=$(printf '%s\n' "echo -e 'a\\x41\\x4a'" "printf '%d\\x42\\n' abc" "test 1 -eq x" | run)
+[ "$OUT" = "$(printf 'aAJ\nprintf: %s: expected a numeric value\n0B\ntest: x: integer expression expected' "'abc'")" ] ||
+    fail "escapes or number errors differ: $OUT"
+
+# printf takes character codes, and leaves %q to the printf program
+OUT=$(printf '%s\n' "printf '%d %x\\n' \"'A\" \"'a\"" "printf '%q\\n' 'a b'" | run | grep -v '^\[')
+[ "$OUT" = "$(printf '65 61\n%s' "'a b'")" ] || fail "printf character codes or %q differ: $OUT"
+
+# Piped input is not recorded in the history
+printf 'echo piped-secret\n' | "$SHELL_BIN" -s "$DIR/session" > /dev/null
+grep -aq piped-secret "$DIR/session" 2>/dev/null && fail "piped input was recorded in the history"
+
+exit $FAILED
@@ -2,431 +2,739 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/time.h>
-#include "Bank.c"
-
-#define MAX_ACCOUNTS 1000
-
-// Structure for a transaction pair
-struct trans { 
-    int acc_id; // account ID
-    int amount; // amount to be added, could be positive or negative
-};
-// Structure for a request
-struct request {
-    struct request * next; // pointer to the next request in the list
-    int request_id; // request ID assigned by the main thread
-    int check_acc_id; // account ID for a CHECK request
-    struct trans * transactions; // array of transaction data
-    int num_trans; // number of accounts in this transaction
-    struct timeval starttime, endtime; // starttime and endtime for TIME
-};
-// Structure for the queue of jobs
-struct queue {
-    struct request * head, * tail; // head and tail of the list
-    int num_jobs; // number of jobs currently in queue
+#include "bankengine.h"
+
+// Kinds of parsed input lines
+#define LINE_EMPTY 0 // blank line, ignored
+#define LINE_REQUEST 1 // CHECK, TRANS, AUDIT or SUM that became a request
+#define LINE_STATS 2 // STATS command
+#define LINE_END 3 // END command
+#define LINE_INVALID 4 // unknown command
+#define LINE_BAD_SUM 5 // SUM without both ends of the range
+#define LINE_BATCH 6 // BATCH command that became an empty BATCH request
+#define LINE_ENDBATCH 7 // ENDBATCH command
+#define LINE_BAD_BATCH 8 // BATCH without a count from 1 to MAX_BATCH
+
+// Most bytes the input pipeline reads at a time
+#define CHUNK_SIZE 65536
+
+// Structure for a chunk of raw input handed to a parser thread
+struct chunk {
+    struct chunk * next; // pointer to the next chunk waiting to be parsed
+    int seq; // position of the chunk in the input
+    long long arrival; // monotonic nanoseconds since startup when the chunk was read
+    char * data; // whole lines of input, NUL terminated
 };
 
 // Declare global variables
-pthread_mutex_t queueMutex; // Holds the mutex for the queue
-pthread_cond_t startWorker; // Holds the conditional to signal workers to run
-pthread_cond_t allJobsFinished; // Holds the conditional to signal when all jobs are done
-struct queue jobQueue; // The queue for all of the jobs
 FILE *file; // The file to write outputs to
-pthread_mutex_t accountMutexes[MAX_ACCOUNTS]; // Holds mutexes for all of the accounts
-int numAvailableWorkers, numWorkers, endFlag = 0; // Holds the number of currently available workers, total number of workers, and an end flag
+int currReqID = 1; // Holds the next request ID, only touched while committing parsed lines
+int endFlag = 0; // Holds the end flag, set once END is committed
+int defaultDeadline = 0; // Holds the deadline in milliseconds given to every request, 0 for none
+struct request* openBatch = NULL; // Holds the BATCH whose lines are being committed, NULL outside one - only touched while committing
+
+// Input pipeline - the main thread reads chunks, parser threads parse them and commit them in input order
+int numParsers = 0; // Holds the number of parser threads, 0 for the interactive input loop
+pthread_mutex_t chunkMutex; // Holds the mutex for the chunk queue
+pthread_cond_t chunkReady; // Holds the conditional to signal parsers that a chunk is waiting
+pthread_cond_t chunkSpace; // Holds the conditional to signal the reader that the chunk queue has room
+struct chunk * chunkHead, * chunkTail; // Holds the chunks waiting to be parsed
+int numChunks = 0, readerDone = 0; // Holds the number of waiting chunks and whether the reader hit the end of the input
+pthread_mutex_t commitMutex; // Holds the mutex that orders commits of parsed chunks
+pthread_cond_t commitTurn; // Holds the conditional to signal that the next chunk may commit
+int nextCommitSeq = 0; // Holds the sequence number of the next chunk to commit
+int endPipe[2]; // Holds a pipe written once END is committed, so the reader stops waiting on the input
+
+// Trace capture - every accepted line is recorded with its arrival time for the replay tool
+//  - The file starts with TRACE_MAGIC, then one record per line
+//  - A record is the nanoseconds since the previous record and the line length, both as varints, then the line
+#define TRACE_MAGIC "BANKTRC1"
+FILE *traceFile = NULL; // Holds the trace file, NULL when not capturing
+long long lastTraceTime = 0; // Holds the arrival time of the last record written
+struct timespec startClock; // Holds the monotonic time at startup
 
 // Declare functions
-void *workers(void *);
-void *runWorkers(void *);
-void balCheck(struct request* nextRequest);
-void transactionReq(struct request* nextRequest);
-void quickSort(int arr[], int low, int high);
-int partition(int arr[], int low, int high);
-void swap(int* p1, int* p2);
+void writeResult(const struct bank_result* result, void* arg);
+void writeOutcome(const struct bank_result* result);
+void printStats();
+int parseLine(char* line, struct request** newRequest);
+int commitLines(int kinds[], struct request* reqs[], int numLines);
+void runPipeline();
+void dispatchChunk(char* data, int seq, long long arrival);
+long long monotonicNow();
+void traceLines(int kinds[], char* rawLines[], int numLines, long long arrival);
+void writeVarint(unsigned long long value);
+void *parser(void *);
 
 /* The main function for the banking system
  * Inputs:
  *    Arg 1 -- # of worker threads
  *    Arg 2 -- # of accounts
  *    Arg 3 -- Output file name
+ * Switches:
+ *    -partition : Split the accounts into one partition per worker, each worker pinned to a core
+ *    -q <capacity> : Bound the job queue to capacity requests - Default is unbounded
+ *    -policy <block|reject|shed> : What to do with a request when the queue is full - Default is block
+ *    -parsers <n> : Read the input as it arrives and parse it on n threads - Default is the interactive loop
+ *    -trace <file> : Record every accepted line and its arrival time to file for the replay tool
+ *    -deadline <ms> : Expire any request still queued ms milliseconds after it is read - Default is no deadline
 */
 int main(int argc, char *argv[]) {
-    // Initialize queue mutex
-    pthread_mutex_init(&queueMutex, NULL);
-
-    // Initialize conditional that signals workers to run
-    pthread_cond_init(&startWorker, NULL);
-
-    // The current request ID
-    int currReqID = 1;
-
     // Retrieve the passed in values
     // Arg 1 -- # of worker threads
     // Arg 2 -- # of accounts
     // Arg 3 -- output file
-    numWorkers = atoi(argv[1]);
-    int numAccounts = atoi(argv[2]);
+    struct bank_config config = {0};
+    config.num_workers = atoi(argv[1]);
+    config.num_accounts = atoi(argv[2]);
+    config.queue_policy = POLICY_BLOCK;
     char outputFile[500];
     strncpy(outputFile, argv[3], sizeof(outputFile) - 1);
 
-    // Open the file with write priveleges
-    file = fopen(outputFile, "w+");
-
-    // Holds the pthread workers
-    pthread_t pthreadWorkers[numWorkers];
-
-    // Create all pthreads
-    for (int i = 0; i < numWorkers; i++) {
-        pthread_create(&pthreadWorkers[i], NULL, workers, NULL);
+    // Loop through the optional switches after the required arguments
+    for (int i = 4; i < argc; i++) {
+        // Check for the -partition switch
+        if (!strcmp(argv[i], "-partition")) {
+            config.partitioned = 1;
+        }
+        // Check for the -q switch
+        if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            config.queue_capacity = atoi(argv[++i]);
+        }
+        // Check for the -trace switch
+        if (!strcmp(argv[i], "-trace") && i + 1 < argc) {
+            traceFile = fopen(argv[++i], "wb");
+            if (traceFile == NULL) {
+                printf("Failed to open trace file %s, exiting.\n", argv[i]);
+                exit(1);
+            }
+            fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), traceFile);
+        }
+        // Check for the -parsers switch
+        if (!strcmp(argv[i], "-parsers") && i + 1 < argc) {
+            numParsers = atoi(argv[++i]);
+        }
+        // Check for the -deadline switch
+        if (!strcmp(argv[i], "-deadline") && i + 1 < argc) {
+            defaultDeadline = atoi(argv[++i]);
+        }
+        // Check for the -policy switch
+        if (!strcmp(argv[i], "-policy") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "reject")) {
+                config.queue_policy = POLICY_REJECT;
+            } else if (!strcmp(argv[i], "shed")) {
+                config.queue_policy = POLICY_SHED;
+            } else {
+                config.queue_policy = POLICY_BLOCK;
+            }
+        }
     }
 
-    // Holds a pthread to signal the workers to run
-    pthread_t pthreadRunWorkers;
-    pthread_create(&pthreadRunWorkers, NULL, runWorkers, NULL);
-    // Signal to send when there are no jobs
-    pthread_cond_init(&allJobsFinished, NULL);
+    // Open the file with write priveleges
+    file = fopen(outputFile, "w+");
 
-    // Initialize all mutexes
-    for (int i = 0; i < numAccounts; i++) {
-        pthread_mutex_init(&accountMutexes[i], NULL);
-    }
+    // Arrival times in the trace are relative to startup
+    clock_gettime(CLOCK_MONOTONIC, &startClock);
 
-    // Initialize the bank accounts - Error out if the init fails
-    if (!initialize_accounts(numAccounts)) {
+    // Start the bank engine, writing every result to the file - Error out if the init fails
+    if (!bank_init(&config, writeResult, NULL)) {
         printf("Failed to initialize accounts, exiting.\n");
         exit(1);
     }
 
-    while(1) {
-        // Print the > sign - means input line
-        printf("> ");
-
-        // Create a variable to handle input
-        char tempInput[500];
-        
-        // Read the user input -- error if fgets fails
-        if (fgets(tempInput, 500, stdin) == NULL) { exit(1); }
-        // Remove the extra newline characters
-        tempInput[strcspn(tempInput, "\n")] = 0;
-        // Remove whitespace at start
-        int i, j, regChar = 0;
-        char input[500];
-        for (i = 0, j = 0; i < strlen(tempInput); i++, j++) {
-            // Copy over all characters that are not whitespace until first non-whitespace char, then copy all
-            if (regChar || tempInput[i] != ' ') {
-                regChar = 1; // Set the flag to 1 to notify to copy the rest, including whitespaces
-                input[j] = tempInput[i];
-            } else {
-                j--;
-            }
-        }
-        input[j] = 0;
-
-        // If the user input is empty, continue the loop
-        if (!strcmp(input, "")) {
-            continue;
-        }
-
-        // Depending on the type of the request, perform the related action
-        if (!strncmp(input, "CHECK", 5) || !strncmp(input, "TRANS", 5)) {
-            // Get the total list
-            char* requestArgs[30];
-            // Keep track of the number of arguments -- Start at 0 to ignore first value
-            int numArgs = 0;
-
-            // Get the first value in inputCopy
-            char* ptr = strtok(input, " ");
-            // Loop through inputCopy until it is NULL
-            while (ptr != NULL) {
-                requestArgs[numArgs++] = ptr;
-                ptr = strtok(NULL, " ");
+    if (numParsers > 0) {
+        // Read the input as it arrives and parse it on the parser threads
+        runPipeline();
+        // Like fgets failing in the interactive loop, running out of input before END is an error
+        if (!endFlag) { exit(1); }
+    } else {
+        while(1) {
+            // Print the > sign - means input line
+            printf("> ");
+
+            // Create a variable to handle input
+            char input[500];
+
+            // Read the user input -- error if fgets fails
+            if (fgets(input, 500, stdin) == NULL) { exit(1); }
+            long long arrival = monotonicNow();
+            // Remove the extra newline characters
+            input[strcspn(input, "\n")] = 0;
+
+            // Keep a copy of the line for the trace, since parsing modifies it
+            char rawInput[500];
+            char* rawLine = rawInput;
+            if (traceFile != NULL) {
+                strcpy(rawInput, input);
             }
 
-            // Create a new request
+            // Parse the line and act on it, stopping once END is entered
             struct request* newRequest;
-            // Allocate memory
-            newRequest = (struct request*) malloc(sizeof(struct request));
-
-            // Fill generic data
-            gettimeofday(&newRequest->starttime, NULL);
-            newRequest->request_id = currReqID++;
-
-            // Print out the ID
-            printf("< ID %d\n", newRequest->request_id);
-
-            // Determine which request occurred
-            if (!strncmp(input, "CHECK", 5)) {
-                // Fill the request with data
-                newRequest->check_acc_id = atoi(requestArgs[1]);
-            } else {
-                // Create the transaction array
-                struct trans* transactions;
-                // Keep track of where we are in the requestArgs array
-                int currLoc = 1;
-                // Divide the number or aguments by two to ignore amount values
-                numArgs /= 2;
-                // Allocate memory
-                transactions = (struct trans*) malloc(numArgs * sizeof(struct trans));
-
-                // Loop through all of the transactions to occur
-                for (int i = 0; i < numArgs; i++) {
-                    struct trans transaction = {atoi(requestArgs[currLoc++]), atoi(requestArgs[currLoc++])};
-                    transactions[i] = transaction;
-                }
-
-                // Fill the request with data
-                newRequest->num_trans = numArgs;
-                newRequest->transactions = transactions;
+            int kind = parseLine(input, &newRequest);
+            traceLines(&kind, &rawLine, 1, arrival);
+            if (commitLines(&kind, &newRequest, 1)) {
+                break;
             }
-
-            // Lock the queue
-            pthread_mutex_lock(&queueMutex);
-            
-            // Add the request to the queue
-            if (jobQueue.head == NULL) {
-                jobQueue.head = newRequest;
-                jobQueue.tail = newRequest;
-            } else {
-                jobQueue.tail->next = newRequest;
-                jobQueue.tail = newRequest;
-            }
-
-            // Increment the total number of jobs
-            jobQueue.num_jobs++;
-
-            // Unlock the queue
-            pthread_mutex_unlock(&queueMutex);
-        } else if (!strncmp(input, "END", 3)) {
-            endFlag = 1;
-            break;
-        } else {
-            // If execution arrives here, an invalid request was entered
-            printf("An invalid request was entered. The following are allowed: CHECK, TRANS, END.\n");
-            continue;
         }
     }
 
-    // Wait for a signal saying all jobs have finished
-    pthread_mutex_lock(&queueMutex);
-    pthread_cond_wait(&allJobsFinished, &queueMutex);
-    pthread_mutex_unlock(&queueMutex);
+    // Report the final admission stats
+    printStats();
 
-    // Free the bank accounts & close the file
-    free_accounts();
+    // Finish the trace
+    if (traceFile != NULL) {
+        fclose(traceFile);
+    }
+
+    // Wait for every request to finish, then stop the engine & close the file
+    bank_shutdown();
     fclose(file);
     exit(0);
 }
 
-/* Holds the thread that tells the worker threads when to run
+/* Writes the result of a request to the output file
+ *  - Called by the engine on a worker thread for every completed request
+ *  - A BATCH is written as one block: a BATCH line with the member count, outcome and times,
+ *    then a line for each member that ran, all written while the file stays locked
+ *
  * Inputs:
+ *    result -- The result of the request
  *    arg -- No inputs are required
 */
-void *runWorkers(void *arg) {
-    // Infinite loop
-    while (1) {
-        // Lock the queue mutex
-        pthread_mutex_lock(&queueMutex);
-        // If any jobs are available, send a signal
-        if (jobQueue.num_jobs > 0) {
-            pthread_cond_signal(&startWorker);
-        } else if (endFlag && numAvailableWorkers == numWorkers) {
-            pthread_cond_signal(&allJobsFinished);
-        }
-        // Unlock the mutex
-        pthread_mutex_unlock(&queueMutex);
+void writeResult(const struct bank_result* result, void* arg) {
+    // Lock the file
+    flockfile(file);
+    // Print the request ID, then the outcome depending on the status and type of the request
+    fprintf(file, "%d ", result->request_id);
+    if (result->type == REQ_BATCH) {
+        fprintf(file, "BATCH %d ", result->num_batch);
+    }
+    writeOutcome(result);
+    // Print the start and end times
+    fprintf(file, " TIME %ld.%06ld %ld.%06ld\n", result->starttime.tv_sec, result->starttime.tv_usec, result->endtime.tv_sec, result->endtime.tv_usec);
+    // Print the members of a batch that ran
+    for (int i = 0; result->batch_results != NULL && i < result->num_batch; i++) {
+        fprintf(file, "%d ", result->batch_results[i].request_id);
+        writeOutcome(&result->batch_results[i]);
+        fprintf(file, "\n");
     }
+    // Unlock the file
+    funlockfile(file);
 }
 
-/* Holds all of the worker threads
- *  - Keeps track of available workers and pulls jobs off the queue
- *  - Calls the appropriate helper method to perform the request 
+/* Writes the outcome of a request to the output file, depending on its status and type
+ *  - Must be called with the file locked
  *
  * Inputs:
- *    arg -- No inputs are required
+ *    result -- The result of the request
 */
-void *workers(void *arg) {
-    // Infinite loop
-    while (1) {
-        // Lock the queue mutex
-        pthread_mutex_lock(&queueMutex);
-        // Increment the number of available workers
-        numAvailableWorkers++;
-        // Wait for the associated conditional variable to be signaled
-        while (jobQueue.num_jobs == 0) {
-            pthread_cond_wait(&startWorker, &queueMutex);
-        }
-        // Decrement the number of available workers
-        numAvailableWorkers--;
-        // Grab the next job off the queue
-        struct request* nextRequest = (struct request*) malloc(sizeof(struct request));
-        nextRequest = jobQueue.head;
-        jobQueue.head = jobQueue.head->next;
-        jobQueue.num_jobs--;
-        // Unlock the queue mutex
-        pthread_mutex_unlock(&queueMutex);
-        // Call helper functions
-        if (nextRequest->check_acc_id != 0) {
-            // It must be a balance check - call the helper
-            balCheck(nextRequest);
-        } else {
-            // It must be a transaction - call the helper
-            transactionReq(nextRequest);
-        }
+void writeOutcome(const struct bank_result* result) {
+    if (result->status == RESULT_REJECT) {
+        fprintf(file, "REJECT %s", result->reason);
+    } else if (result->status == RESULT_EXPIRED) {
+        fprintf(file, "EXPIRED");
+    } else if (result->status == RESULT_ISF) {
+        fprintf(file, "ISF %lld", result->value);
+    } else if (result->type == REQ_CHECK) {
+        fprintf(file, "BAL %lld", result->value);
+    } else if (result->type == REQ_TRANS) {
+        fprintf(file, "OK");
+    } else if (result->type == REQ_BATCH) {
+        fprintf(file, "OK ISF %lld", result->value);
+    } else {
+        fprintf(file, "%s %lld", result->type == REQ_AUDIT ? "AUDIT" : "SUM", result->value);
     }
 }
 
-/* Performs a balance check on the given request
+/* Prints the admission stats for the job queue
+*/
+void printStats() {
+    struct bank_stats stats;
+    bank_get_stats(&stats);
+    printf("< STATS DEPTH %d MAXDEPTH %d ACCEPTED %d REJECTED %d SHED %d EXPIRED %d\n", stats.depth, stats.max_depth, stats.accepted, stats.rejected, stats.shed, stats.expired);
+}
+
+/* Parses one line of input
+ *  - Skips leading whitespace and tokenizes the line in place, so the line is modified
+ *  - Safe to call from several parser threads at once
+ *
  * Inputs:
- *    nextRequest -- The request struct that holds the balance check
+ *    line -- The line of input, without the newline
+ *    newRequest -- Set to the new request when the line is a CHECK, TRANS, AUDIT or SUM
+ *
+ * Outputs:
+ *    int -- The LINE_* kind of the line
 */
-void balCheck(struct request* nextRequest) {
-    // Lock the account's mutex
-    pthread_mutex_lock(&accountMutexes[nextRequest->check_acc_id - 1]);
-    // Get the balance of the account
-    int bal = read_account(nextRequest->check_acc_id);
-    // Unlock the account's mutex
-    pthread_mutex_unlock(&accountMutexes[nextRequest->check_acc_id - 1]);
-
-    // Get the end time
-    gettimeofday(&nextRequest->endtime, NULL);
-    // Lock the file, print, unlock the file
-    flockfile(file);
-    fprintf(file, "%d BAL %d TIME %ld.%06ld %ld.%06ld\n", nextRequest->request_id, bal, 
-        nextRequest->starttime.tv_sec, nextRequest->starttime.tv_usec, nextRequest->endtime.tv_sec, nextRequest->endtime.tv_usec);
-    funlockfile(file);
+int parseLine(char* line, struct request** newRequest) {
+    *newRequest = NULL;
+
+    // Remove whitespace at start
+    while (*line == ' ') {
+        line++;
+    }
+
+    // If the input is empty, there is nothing to do
+    if (!strcmp(line, "")) {
+        return LINE_EMPTY;
+    }
+
+    // Commands that do not become requests
+    if (!strncmp(line, "STATS", 5)) {
+        return LINE_STATS;
+    } else if (!strncmp(line, "ENDBATCH", 8)) {
+        return LINE_ENDBATCH;
+    } else if (!strncmp(line, "END", 3)) {
+        return LINE_END;
+    } else if (strncmp(line, "CHECK", 5) && strncmp(line, "TRANS", 5) && strncmp(line, "AUDIT", 5) && strncmp(line, "SUM", 3) && strncmp(line, "BATCH", 5)) {
+        return LINE_INVALID;
+    }
+
+    // Get the total list
+    char* requestArgs[30];
+    // Keep track of the number of arguments
+    int numArgs = 0;
+
+    // Get the first value in line
+    char* savePtr;
+    char* ptr = strtok_r(line, " ", &savePtr);
+    // Loop through line until it is NULL
+    while (ptr != NULL && numArgs < 30) {
+        requestArgs[numArgs++] = ptr;
+        ptr = strtok_r(NULL, " ", &savePtr);
+    }
+
+    // A trailing DEADLINE <ms> overrides the default deadline for this request
+    int deadline = defaultDeadline;
+    if (numArgs >= 3 && !strcmp(requestArgs[numArgs - 2], "DEADLINE")) {
+        deadline = atoi(requestArgs[numArgs - 1]);
+        numArgs -= 2;
+    }
+
+    // SUM needs both ends of the range
+    if (!strncmp(line, "SUM", 3) && numArgs < 3) {
+        return LINE_BAD_SUM;
+    }
+
+    // Create the request - the ID is assigned once the line is committed in input order
+    struct request* req;
+
+    // Determine which request occurred
+    if (!strncmp(line, "BATCH", 5)) {
+        // The members are added as their lines are committed
+        char* end = "";
+        long numMembers = numArgs >= 2 ? strtol(requestArgs[1], &end, 10) : 0;
+        if (*end || numMembers < 1 || numMembers > MAX_BATCH || (req = bank_new_batch(numMembers)) == NULL) {
+            return LINE_BAD_BATCH;
+        }
+        bank_set_deadline(req, deadline);
+        *newRequest = req;
+        return LINE_BATCH;
+    } else if (!strncmp(line, "CHECK", 5)) {
+        req = bank_new_check(atoi(requestArgs[1]));
+    } else if (!strncmp(line, "AUDIT", 5)) {
+        req = bank_new_audit();
+    } else if (!strncmp(line, "SUM", 3)) {
+        req = bank_new_sum(atoi(requestArgs[1]), atoi(requestArgs[2]));
+    } else {
+        // Divide the number or aguments by two to ignore amount values
+        numArgs /= 2;
+        req = bank_new_trans(numArgs);
+
+        // Loop through all of the transactions to occur
+        int currLoc = 1;
+        for (int i = 0; i < numArgs; i++) {
+            struct trans transaction = {atoi(requestArgs[currLoc++]), atoi(requestArgs[currLoc++])};
+            req->transactions[i] = transaction;
+        }
+    }
+
+    bank_set_deadline(req, deadline);
+    *newRequest = req;
+    return LINE_REQUEST;
 }
 
-/* Performs a transaction request
+/* Commits parsed lines in input order
+ *  - Assigns request IDs and submits each run of requests to the job queue as one batch
+ *  - Requests between BATCH n and ENDBATCH are moved into the BATCH request, which is given their IDs and
+ *    submitted alone at ENDBATCH; this is done at commit time, so a batch may span chunks parsed on different threads
+ *  - A BATCH that is not exactly n CHECK or TRANS lines then ENDBATCH is dropped without running
+ *  - Lines after END are dropped
+ *  - Callers must commit one group of lines at a time, in input order
+ *
  * Inputs:
- *    nextRequest -- The request struct that holds the transaction
+ *    kinds -- The LINE_* kind of each line
+ *    reqs -- The request for each LINE_REQUEST line
+ *    numLines -- The number of lines
+ *
+ * Outputs:
+ *    int -- 1 once END has been committed, 0 otherwise
 */
-void transactionReq(struct request* nextRequest) {
-    // Get a list of all accounts affected
-    int accountList[nextRequest->num_trans];
-    for (int i = 0; i < nextRequest->num_trans; i++) {
-        accountList[i] = nextRequest->transactions[i].acc_id;
+int commitLines(int kinds[], struct request* reqs[], int numLines) {
+    // Start of the current run of requests
+    int runStart = 0;
+
+    for (int i = 0; i < numLines; i++) {
+        // Drop everything after END
+        if (endFlag) {
+            if (kinds[i] == LINE_REQUEST || kinds[i] == LINE_BATCH) {
+                bank_free_request(reqs[i]);
+            }
+            continue;
+        }
+
+        if (kinds[i] == LINE_REQUEST && openBatch == NULL) {
+            // Assign the ID and print it out
+            reqs[i]->request_id = currReqID++;
+            printf("< ID %d\n", reqs[i]->request_id);
+            continue;
+        }
+
+        // Submit the requests before this line so commands act in order
+        bank_submit_batch(&reqs[runStart], i - runStart);
+        runStart = i + 1;
+
+        // Lines of an open batch
+        if (openBatch != NULL) {
+            if (kinds[i] == LINE_EMPTY) {
+                continue;
+            }
+            if (kinds[i] == LINE_REQUEST && bank_batch_add(openBatch, reqs[i])) {
+                continue;
+            }
+            if (kinds[i] == LINE_ENDBATCH && openBatch->num_batch == openBatch->batch_cap) {
+                // Give the members their IDs and submit the whole batch at once
+                for (int m = 0; m < openBatch->num_batch; m++) {
+                    openBatch->batch[m].request_id = currReqID++;
+                }
+                openBatch->request_id = openBatch->batch[0].request_id;
+                printf("< ID %d-%d\n", openBatch->request_id, currReqID - 1);
+                bank_submit(openBatch);
+                openBatch = NULL;
+                continue;
+            }
+
+            // Anything else drops the batch, then is handled as usual
+            printf("BATCH dropped: it must hold exactly %d CHECK or TRANS lines, then ENDBATCH.\n", openBatch->batch_cap);
+            bank_free_request(openBatch);
+            openBatch = NULL;
+            if (kinds[i] == LINE_REQUEST) {
+                bank_free_request(reqs[i]);
+                continue;
+            } else if (kinds[i] == LINE_ENDBATCH) {
+                continue;
+            }
+        }
+
+        // Depending on the kind of the line, perform the related action
+        if (kinds[i] == LINE_BATCH) {
+            openBatch = reqs[i];
+        } else if (kinds[i] == LINE_BAD_BATCH) {
+            printf("BATCH requires a request count from 1 to %d: BATCH <n>\n", MAX_BATCH);
+        } else if (kinds[i] == LINE_ENDBATCH) {
+            printf("ENDBATCH without BATCH\n");
+        } else if (kinds[i] == LINE_STATS) {
+            printStats();
+        } else if (kinds[i] == LINE_END) {
+            endFlag = 1;
+        } else if (kinds[i] == LINE_BAD_SUM) {
+            printf("SUM requires an account range: SUM <lo> <hi>\n");
+        } else if (kinds[i] == LINE_INVALID) {
+            // If execution arrives here, an invalid request was entered
+            printf("An invalid request was entered. The following are allowed: CHECK, TRANS, AUDIT, SUM, BATCH, ENDBATCH, STATS, END.\n");
+        }
     }
 
-    // Sort the account IDs
-    quickSort(accountList, 0, nextRequest->num_trans - 1);
+    // Submit the requests left at the end
+    if (runStart < numLines && !endFlag) {
+        bank_submit_batch(&reqs[runStart], numLines - runStart);
+    }
+    return endFlag;
+}
 
-    // Lock all associated accounts in ascending order
-    for (int i = 0; i < nextRequest->num_trans; i++) {
-        // Lock the account's mutex
-        pthread_mutex_lock(&accountMutexes[accountList[i] - 1]);
+/* Reads the input and hands it to the parser threads in chunks
+ *  - Each read takes whatever has arrived on fd 0, up to CHUNK_SIZE bytes, so lines are handed off as soon as they arrive
+ *  - Chunks are cut at the last newline so every chunk holds whole lines
+ *  - Stops reading once END has been committed or the input runs out - the reader waits on endPipe along with the input,
+ *    so END ends the server even while the input stays open
+*/
+void runPipeline() {
+    // Initialize the chunk queue and commit ordering
+    pthread_mutex_init(&chunkMutex, NULL);
+    pthread_cond_init(&chunkReady, NULL);
+    pthread_cond_init(&chunkSpace, NULL);
+    pthread_mutex_init(&commitMutex, NULL);
+    pthread_cond_init(&commitTurn, NULL);
+    if (pipe(endPipe) < 0) {
+        printf("Failed to create the input pipeline, exiting.\n");
+        exit(1);
     }
 
-    // Flag for if an invalid balance was found
-    int invalidBalance = 0;
-    // Holds the account that had an issue
-    int invalidAccID;
-
-    // Loop through the transactions
-    for (int i = 0; i < nextRequest->num_trans; i++) {
-        if ((read_account(nextRequest->transactions[i].acc_id) + nextRequest->transactions[i].amount) < 0) {
-            // Set the invalid account ID
-            invalidAccID = nextRequest->transactions[i].acc_id;
-            // Set the flag to 1
-            invalidBalance = 1;
-            // Break out of the loop
+    // Create all parser threads
+    pthread_t parsers[numParsers];
+    for (int i = 0; i < numParsers; i++) {
+        pthread_create(&parsers[i], NULL, parser, NULL);
+    }
+
+    // Partial line left over from the previous read
+    char* carry = NULL;
+    int carryLen = 0, seq = 0;
+
+    while (1) {
+        // Wait for input, stopping once END has been committed
+        struct pollfd fds[2] = {{0, POLLIN, 0}, {endPipe[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             break;
         }
-    }
+        if (fds[1].revents) {
+            break;
+        }
+
+        // Read the next chunk after the leftover partial line
+        char* buf = (char*) malloc(carryLen + CHUNK_SIZE + 1);
+        if (carryLen > 0) {
+            memcpy(buf, carry, carryLen);
+        }
+        free(carry);
+        carry = NULL;
+        ssize_t got;
+        do {
+            got = read(0, buf + carryLen, CHUNK_SIZE);
+        } while (got < 0 && errno == EINTR);
+        int len = carryLen + (got > 0 ? got : 0);
+        long long arrival = monotonicNow();
+
+        // End of the input - hand off whatever is left
+        if (len == carryLen) {
+            carryLen = 0;
+            if (len > 0) {
+                buf[len] = 0;
+                dispatchChunk(buf, seq++, arrival);
+            } else {
+                free(buf);
+            }
+            break;
+        }
+
+        // Find the end of the last whole line
+        int last = len - 1;
+        while (last >= 0 && buf[last] != '\n') {
+            last--;
+        }
+
+        if (last < 0) {
+            // No whole line yet - keep everything for the next read
+            carry = buf;
+            carryLen = len;
+            continue;
+        }
 
-    // If no invalid balanace was found, perform the transactions
-    if (!invalidBalance) {
-        for (int i = 0; i < nextRequest->num_trans; i++) {
-            // Write the new value to the account
-            write_account(nextRequest->transactions[i].acc_id, read_account(nextRequest->transactions[i].acc_id) + nextRequest->transactions[i].amount);
+        // Keep the partial line for the next read and hand off the rest
+        carryLen = len - last - 1;
+        if (carryLen > 0) {
+            carry = (char*) malloc(carryLen);
+            memcpy(carry, buf + last + 1, carryLen);
         }
+        buf[last] = 0;
+        dispatchChunk(buf, seq++, arrival);
+    }
+    free(carry);
+
+    // Let the parsers finish the chunks that are left
+    pthread_mutex_lock(&chunkMutex);
+    readerDone = 1;
+    pthread_cond_broadcast(&chunkReady);
+    pthread_mutex_unlock(&chunkMutex);
+    for (int i = 0; i < numParsers; i++) {
+        pthread_join(parsers[i], NULL);
     }
+}
 
-    // Unlock all associated accounts in ascending order
-    for (int i = 0; i < nextRequest->num_trans; i++) {
-        // Unlock the account's mutex
-        pthread_mutex_unlock(&accountMutexes[accountList[i] - 1]);
+/* Adds a chunk of input to the chunk queue, waiting if the parsers are too far behind
+ * Inputs:
+ *    data -- The NUL terminated lines of input
+ *    seq -- The position of the chunk in the input
+ *    arrival -- When the chunk was read, from monotonicNow
+*/
+void dispatchChunk(char* data, int seq, long long arrival) {
+    // Build the chunk
+    struct chunk* newChunk = (struct chunk*) malloc(sizeof(struct chunk));
+    newChunk->next = NULL;
+    newChunk->seq = seq;
+    newChunk->data = data;
+    newChunk->arrival = arrival;
+
+    // Lock the chunk queue, waiting while two chunks per parser are already waiting
+    pthread_mutex_lock(&chunkMutex);
+    while (numChunks >= 2 * numParsers) {
+        pthread_cond_wait(&chunkSpace, &chunkMutex);
     }
 
-    // Get the end time
-    gettimeofday(&nextRequest->endtime, NULL);
-    // Lock the file
-    flockfile(file);
-    // Depending ont he state of the invalidBalance flag, print the output
-    if (!invalidBalance) {
-        // Print the successful output
-        fprintf(file, "%d OK TIME %ld.%06ld %ld.%06ld\n", nextRequest->request_id, 
-            nextRequest->starttime.tv_sec, nextRequest->starttime.tv_usec, nextRequest->endtime.tv_sec, nextRequest->endtime.tv_usec);
+    // Add the chunk to the queue and wake a parser
+    if (chunkHead == NULL) {
+        chunkHead = newChunk;
     } else {
-        // Print out the unsuccessful output
-        fprintf(file, "%d ISF %d TIME %ld.%06ld %ld.%06ld\n", nextRequest->request_id, invalidAccID, 
-            nextRequest->starttime.tv_sec, nextRequest->starttime.tv_usec, nextRequest->endtime.tv_sec, nextRequest->endtime.tv_usec);
+        chunkTail->next = newChunk;
     }
-    // Unlock the file
-    funlockfile(file);
+    chunkTail = newChunk;
+    numChunks++;
+    pthread_cond_signal(&chunkReady);
+    pthread_mutex_unlock(&chunkMutex);
 }
 
-/* Quicksort -- Sorts the array in ascending order
+/* Holds all of the parser threads
+ *  - Parses whole chunks in parallel, then waits for the chunk's turn to commit it in input order
+ *
  * Inputs:
- *    arr -- The array to sort
- *    min -- The minimum index of arr
- *    max -- The maximum index of arr
+ *    arg -- No inputs are required
 */
-void quickSort(int arr[], int min, int max)
-{
-    // When min is less than max
-    if (min < max) {
-        // Get the partition index
-        int returnIdx = partition(arr, min, max);
-
-        // Recursion Calls
-        // Smaller element than pivot goes left and max element goes right
-        quickSort(arr, min, returnIdx - 1);
-        quickSort(arr, returnIdx + 1, max);
+void *parser(void *arg) {
+    while (1) {
+        // Wait for a chunk, finishing once the reader is done and the queue is empty
+        pthread_mutex_lock(&chunkMutex);
+        while (chunkHead == NULL && !readerDone) {
+            pthread_cond_wait(&chunkReady, &chunkMutex);
+        }
+        struct chunk* nextChunk = chunkHead;
+        if (nextChunk == NULL) {
+            pthread_mutex_unlock(&chunkMutex);
+            return NULL;
+        }
+        chunkHead = nextChunk->next;
+        numChunks--;
+        pthread_cond_signal(&chunkSpace);
+        pthread_mutex_unlock(&chunkMutex);
+
+        // Count the lines so the parsed results fit in one allocation
+        int numLines = 1;
+        for (char* c = nextChunk->data; *c; c++) {
+            if (*c == '\n') {
+                numLines++;
+            }
+        }
+        int* kinds = (int*) malloc(numLines * sizeof(int));
+        struct request** reqs = (struct request**) malloc(numLines * sizeof(struct request*));
+
+        // Keep a copy of the chunk for the trace, since parsing modifies it
+        char* raw = NULL;
+        char** rawLines = NULL;
+        if (traceFile != NULL) {
+            raw = strdup(nextChunk->data);
+            rawLines = (char**) malloc(numLines * sizeof(char*));
+        }
+
+        // Parse every line of the chunk
+        char* line = nextChunk->data;
+        for (int i = 0; i < numLines; i++) {
+            char* newline = strchr(line, '\n');
+            if (newline != NULL) {
+                *newline = 0;
+            }
+            if (raw != NULL) {
+                // Split the copy at the same place
+                rawLines[i] = raw + (line - nextChunk->data);
+                rawLines[i][strlen(line)] = 0;
+            }
+            kinds[i] = parseLine(line, &reqs[i]);
+            line = newline + 1;
+        }
+
+        // Wait for this chunk's turn, then commit it
+        pthread_mutex_lock(&commitMutex);
+        while (nextChunk->seq != nextCommitSeq) {
+            pthread_cond_wait(&commitTurn, &commitMutex);
+        }
+        traceLines(kinds, rawLines, numLines, nextChunk->arrival);
+        int wasEnded = endFlag;
+        commitLines(kinds, reqs, numLines);
+        // Wake the reader the first time END is committed
+        if (endFlag && !wasEnded && write(endPipe[1], "", 1) < 0) {
+            perror("write");
+        }
+        nextCommitSeq++;
+        pthread_cond_broadcast(&commitTurn);
+        pthread_mutex_unlock(&commitMutex);
+
+        // Free the chunk
+        free(kinds);
+        free(reqs);
+        free(raw);
+        free(rawLines);
+        free(nextChunk->data);
+        free(nextChunk);
     }
 }
 
-/* Partitions the array based on min and max
- * Inputs:
- *    arr -- The array to partition
- *    min -- The minimum index of arr
- *    max -- The maxmimum index of arr
- * 
+/* Returns the monotonic time since startup
  * Outputs:
- *    int -- Returns the partition index
+ *    long long -- Nanoseconds since startup
 */
-int partition(int arr[], int min, int max)
-{
-    // Choose the pivot as the max index
-    int pivot = arr[max];
-
-    // Index of smaller element and Indicate
-    // the right position of pivot found so far
-    int i = (min - 1);
-
-    for (int j = min; j <= max; j++) {
-        // If current element is smaller than the pivot
-        if (arr[j] < pivot) {
-            // Increment index of smaller element
-            i++;
-            // Swap the values
-            swap(&arr[i], &arr[j]);
+long long monotonicNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - startClock.tv_sec) * 1000000000LL + (now.tv_nsec - startClock.tv_nsec);
+}
+
+/* Records accepted lines to the trace file
+ *  - Only CHECK, TRANS, AUDIT, SUM, BATCH, ENDBATCH, STATS and END lines are recorded, and nothing after END
+ *  - Must be called in input order, right before the lines are committed
+ *
+ * Inputs:
+ *    kinds -- The LINE_* kind of each line
+ *    rawLines -- The unparsed text of each line
+ *    numLines -- The number of lines
+ *    arrival -- When the lines were read, from monotonicNow
+*/
+void traceLines(int kinds[], char* rawLines[], int numLines, long long arrival) {
+    // Nothing to do if not capturing or the input already ended
+    if (traceFile == NULL || endFlag) {
+        return;
+    }
+
+    for (int i = 0; i < numLines; i++) {
+        // Skip lines that were not accepted
+        if (kinds[i] != LINE_REQUEST && kinds[i] != LINE_BATCH && kinds[i] != LINE_ENDBATCH && kinds[i] != LINE_STATS && kinds[i] != LINE_END) {
+            continue;
+        }
+
+        // Strip the leading whitespace the parser ignored
+        char* line = rawLines[i];
+        while (*line == ' ') {
+            line++;
+        }
+        int len = strlen(line);
+
+        // Write the record - time since the previous record, the length, then the line
+        writeVarint(arrival > lastTraceTime ? arrival - lastTraceTime : 0);
+        if (arrival > lastTraceTime) {
+            lastTraceTime = arrival;
+        }
+        writeVarint(len);
+        fwrite(line, 1, len, traceFile);
+
+        // Nothing after END is ever run
+        if (kinds[i] == LINE_END) {
+            break;
         }
     }
-    // Swap the values and return
-    swap(&arr[i + 1], &arr[max]);
-    return (i + 1);
 }
 
-/* Swaps the values at p1 and p2
+/* Writes an unsigned value to the trace file as a varint, 7 bits per byte, low bits first
  * Inputs:
- *    p1 -- Value 1 to swap
- *    p2 -- Value 2 to swap
+ *    value -- The value to write
 */
-void swap(int* p1, int* p2)
-{
-    int temp;
-    temp = *p1;
-    *p1 = *p2;
-    *p2 = temp;
-}
\ No newline at end of file
+void writeVarint(unsigned long long value) {
+    while (value >= 0x80) {
+        fputc((int) (value & 0x7f) | 0x80, traceFile);
+        value >>= 7;
+    }
+    fputc((int) value, traceFile);
+}
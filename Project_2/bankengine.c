@@ -0,0 +1,1485 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include "bankengine.h"
+#include "Bank.c"
+
+// Structure for the queue of jobs
+//  - Requests without a deadline wait in a FIFO list
+//  - Requests with a deadline wait in a min-heap on the deadline and are always taken first
+struct queue {
+    struct request * head, * tail; // head and tail of the list
+    struct request ** heap; // heap of requests with a deadline, earliest at index 0
+    int heap_size, heap_cap; // number of requests in the heap and its allocated size
+    int num_jobs; // number of jobs currently in queue
+};
+
+// Types of messages passed between partition owners
+#define MSG_PREPARE 1 // coordinator asks a partition to reserve itself for a request
+#define MSG_GRANT 2 // a partition tells the coordinator that it is reserved
+#define MSG_RELEASE 3 // coordinator tells a reserved partition that the request is done
+
+// Most requests bank_submit_batch puts into the job queue under one lock
+#define SUBMIT_CHUNK 256
+
+// Structure for a message between partition owners
+struct message {
+    struct message * next; // pointer to the next message in the mailbox
+    int type; // one of the MSG_* values
+    int from; // partition that sent the message
+    struct request * req; // the cross-partition request the message is about
+};
+// Structure for a partition of accounts owned by a single worker
+struct partition {
+    pthread_t thread; // the worker that owns this partition
+    int id; // index of this partition
+    pthread_mutex_t mutex; // protects the job queue and the mailbox
+    pthread_cond_t wake; // signaled whenever a job or message arrives
+    pthread_cond_t notFull; // signaled whenever a job is taken off the job queue
+    struct queue jobs; // requests routed to this partition by the submitter
+    struct message * msgHead, * msgTail; // mailbox of messages from other partitions
+    struct request * holder; // request this partition is reserved for, NULL if free
+};
+// Structure for the publish sequence of one worker, on its own cache line so commits never share one
+//  - The count is odd while the worker publishes a commit, so an audit can wait for commits in flight without a lock
+struct publisher {
+    _Alignas(64) atomic_uint seq; // number of times the worker started or finished publishing
+};
+// Structure for a result waiting in the completion queue
+struct completion {
+    struct completion * next; // pointer to the next completion in the list
+    struct bank_result result; // the result of the request
+};
+
+// Declare global variables
+static pthread_mutex_t queueMutex; // Holds the mutex for the queue
+static pthread_cond_t startWorker; // Holds the conditional to signal workers to run
+static struct queue jobQueue; // The queue for all of the jobs
+static pthread_mutex_t accountMutexes[MAX_ACCOUNTS]; // Holds mutexes for all of the accounts
+static pthread_t * workerThreads; // Holds the worker threads in the normal mode
+static int numWorkers, numAccounts; // Holds the number of workers and accounts
+static int partitionMode = 0; // 1 if accounts are split into partitions owned by pinned workers
+static int shutdownFlag = 0; // 1 once the workers have been told to exit
+static struct partition * partitions; // Holds all of the partitions in partitioned mode
+
+// Completion tracking
+static bank_callback resultCallback; // Holds the completion callback, NULL to use the completion queue
+static void * callbackArg; // Holds the argument passed to the completion callback
+static pthread_mutex_t pendingMutex; // Holds the mutex for the completion queue and waiting on pending requests
+static pthread_cond_t pendingDone; // Holds the conditional to signal a new completion or no pending requests
+static atomic_int numPending; // Holds the number of submitted requests that have not completed
+static struct completion * completionHead, * completionTail; // Holds the results waiting for bank_poll
+
+// Admission control
+static pthread_cond_t queueNotFull; // Holds the conditional to signal when a job leaves the queue
+static int queueCapacity = 0; // Holds the maximum number of queued jobs, 0 for unbounded
+static int queuePolicy = POLICY_BLOCK; // Holds the policy used when the queue is full
+static atomic_int numAccepted, numRejected, numShed, maxQueueDepth; // Holds the admission stats
+static atomic_int numExpired; // Holds the number of requests that expired before running
+
+// Versioned copy of the balances so AUDIT and SUM can read a consistent view without account locks
+//  - A commit that is the first to touch an account in a new epoch saves the old balance in prevBalances
+//  - An audit starts a new epoch and reads balances written in older epochs and prevBalances for the rest
+//  - Commits only read the epoch and write their own worker's publisher, so they share no written cache line
+static int balances[MAX_ACCOUNTS]; // Holds the latest committed balance of every account
+static int prevBalances[MAX_ACCOUNTS]; // Holds each account's balance from before the epoch in balanceEpochs
+static unsigned int balanceEpochs[MAX_ACCOUNTS]; // Holds the epoch each balance was last written in
+static atomic_uint currentEpoch = 1; // Holds the epoch new commits are written in
+static struct publisher * publishers; // Holds the publish sequence of every worker
+static int numPublishers; // Holds the number of publishers
+static _Thread_local struct publisher * myPublisher; // Holds the publisher of the worker running on this thread
+static pthread_mutex_t auditMutex; // Holds the mutex so only one audit runs at a time and the epoch advances once per audit
+static int auditBalances[MAX_ACCOUNTS]; // Holds the balances copied by the running audit
+static unsigned int auditEpochs[MAX_ACCOUNTS]; // Holds the epochs copied by the running audit
+
+// Declare functions
+static void *workers(void *);
+static void balCheck(struct request* nextRequest);
+static void transactionReq(struct request* nextRequest);
+static void sumReq(struct request* nextRequest);
+static void batchReq(struct request* nextRequest);
+static int applyTransaction(struct request* req, int* invalidAccID);
+static void runRequest(struct request* req);
+static void *partitionWorker(void *);
+static int partitionOf(int acc_id);
+static void routeRequest(struct request* newRequest);
+static void sendMessage(int to, int type, int from, struct request* req);
+static void reserveNext(struct partition* part, struct request* req);
+static void reportResult(struct request* req, int status, long long value, const char* reason);
+static void completeRequest(struct request* req);
+static void pinThread(pthread_t thread, int core);
+static struct request* admitRequest(struct queue* q, pthread_mutex_t* mutex, pthread_cond_t* notFull, struct request* newRequest, int* admitted);
+static void noteQueueDepth(int depth);
+static void queuePush(struct queue* q, struct request* req);
+static struct request* queuePop(struct queue* q);
+static struct request* queueShed(struct queue* q);
+static void heapSwap(struct queue* q, int i, int j);
+static int expireIfLate(struct request* req);
+static long long monotonicNs();
+static void rejectRequest(struct request* req, const char* reason);
+static int validAccounts(struct request* req);
+static void publishBalances(struct request* req);
+static struct request* newRequest(int type);
+static void quickSort(int arr[], int low, int high);
+static int partition(int arr[], int low, int high);
+static void swap(int* p1, int* p2);
+
+/* Starts the engine
+ *  - Initializes the bank accounts and the versioned balances
+ *  - Creates the worker pool, or one pinned owner per partition in partitioned mode
+ *
+ * Inputs:
+ *    config -- The engine settings
+ *    callback -- Called for every completed request, NULL to use bank_poll instead - see bank_callback for the thread
+ *    arg -- Passed to every call of callback
+ *
+ * Outputs:
+ *    int -- 1 if the engine started; 0 if the settings are invalid or the accounts could not be initialized
+*/
+int bank_init(const struct bank_config* config, bank_callback callback, void* arg) {
+    // Check the settings
+    if (config->num_workers < 1 || config->num_accounts < 1 || config->num_accounts > MAX_ACCOUNTS) {
+        return 0;
+    }
+    numWorkers = config->num_workers;
+    numAccounts = config->num_accounts;
+    partitionMode = config->partitioned;
+    queueCapacity = config->queue_capacity;
+    queuePolicy = config->queue_policy;
+    resultCallback = callback;
+    callbackArg = arg;
+
+    // Initialize the bank accounts
+    if (!initialize_accounts(numAccounts)) {
+        return 0;
+    }
+
+    // Initialize the queue, admission control and completion tracking
+    pthread_mutex_init(&queueMutex, NULL);
+    pthread_cond_init(&startWorker, NULL);
+    pthread_cond_init(&queueNotFull, NULL);
+    pthread_mutex_init(&pendingMutex, NULL);
+    pthread_cond_init(&pendingDone, NULL);
+
+    // Initialize the versioned balances from the bank, with a publisher for every worker
+    numPublishers = numWorkers;
+    publishers = (struct publisher*) aligned_alloc(_Alignof(struct publisher), numPublishers * sizeof(struct publisher));
+    memset(publishers, 0, numPublishers * sizeof(struct publisher));
+    pthread_mutex_init(&auditMutex, NULL);
+    for (int i = 0; i < numAccounts; i++) {
+        balances[i] = read_account(i + 1);
+    }
+
+    if (partitionMode) {
+        // Never create more partitions than there are accounts
+        if (numWorkers > numAccounts) {
+            numWorkers = numAccounts;
+        }
+
+        // Create one partition per worker
+        partitions = (struct partition*) calloc(numWorkers, sizeof(struct partition));
+        for (int i = 0; i < numWorkers; i++) {
+            partitions[i].id = i;
+            pthread_mutex_init(&partitions[i].mutex, NULL);
+            pthread_cond_init(&partitions[i].wake, NULL);
+            pthread_cond_init(&partitions[i].notFull, NULL);
+        }
+
+        // Create the owner of each partition and pin it to its own core
+        for (int i = 0; i < numWorkers; i++) {
+            pthread_create(&partitions[i].thread, NULL, partitionWorker, &partitions[i]);
+            pinThread(partitions[i].thread, i);
+        }
+    } else {
+        // Initialize all mutexes
+        for (int i = 0; i < numAccounts; i++) {
+            pthread_mutex_init(&accountMutexes[i], NULL);
+        }
+
+        // Create all pthreads
+        workerThreads = (pthread_t*) malloc(numWorkers * sizeof(pthread_t));
+        for (int i = 0; i < numWorkers; i++) {
+            pthread_create(&workerThreads[i], NULL, workers, &publishers[i]);
+        }
+    }
+    return 1;
+}
+
+/* Waits until every submitted request has completed
+*/
+void bank_drain() {
+    pthread_mutex_lock(&pendingMutex);
+    while (atomic_load(&numPending) > 0) {
+        pthread_cond_wait(&pendingDone, &pendingMutex);
+    }
+    pthread_mutex_unlock(&pendingMutex);
+}
+
+/* Stops the engine
+ *  - Waits for every submitted request, then stops the workers and frees the bank
+ *  - Results still in the completion queue are dropped, along with their member results
+ *  - Every setting, stat and epoch goes back to its starting value, so bank_init can start the engine again
+*/
+void bank_shutdown() {
+    // Let the submitted requests finish
+    bank_drain();
+
+    // Tell the workers to exit and wait for them
+    if (partitionMode) {
+        for (int i = 0; i < numWorkers; i++) {
+            pthread_mutex_lock(&partitions[i].mutex);
+            shutdownFlag = 1;
+            pthread_cond_signal(&partitions[i].wake);
+            pthread_mutex_unlock(&partitions[i].mutex);
+        }
+        for (int i = 0; i < numWorkers; i++) {
+            pthread_join(partitions[i].thread, NULL);
+            free(partitions[i].jobs.heap);
+            pthread_mutex_destroy(&partitions[i].mutex);
+            pthread_cond_destroy(&partitions[i].wake);
+            pthread_cond_destroy(&partitions[i].notFull);
+        }
+        free(partitions);
+        partitions = NULL;
+    } else {
+        pthread_mutex_lock(&queueMutex);
+        shutdownFlag = 1;
+        pthread_cond_broadcast(&startWorker);
+        pthread_mutex_unlock(&queueMutex);
+        for (int i = 0; i < numWorkers; i++) {
+            pthread_join(workerThreads[i], NULL);
+        }
+        free(workerThreads);
+        workerThreads = NULL;
+        free(jobQueue.heap);
+        memset(&jobQueue, 0, sizeof(jobQueue));
+        for (int i = 0; i < numAccounts; i++) {
+            pthread_mutex_destroy(&accountMutexes[i]);
+        }
+    }
+    free(publishers);
+    publishers = NULL;
+
+    // Drop any results nobody polled
+    while (completionHead != NULL) {
+        struct completion* next = completionHead->next;
+        free(completionHead->result.batch_results);
+        free(completionHead);
+        completionHead = next;
+    }
+    completionTail = NULL;
+
+    // Put the engine back the way bank_init expects to find it
+    pthread_mutex_destroy(&queueMutex);
+    pthread_cond_destroy(&startWorker);
+    pthread_cond_destroy(&queueNotFull);
+    pthread_mutex_destroy(&pendingMutex);
+    pthread_cond_destroy(&pendingDone);
+    pthread_mutex_destroy(&auditMutex);
+    shutdownFlag = 0;
+    atomic_store(&numPending, 0);
+    atomic_store(&numAccepted, 0);
+    atomic_store(&numRejected, 0);
+    atomic_store(&numShed, 0);
+    atomic_store(&maxQueueDepth, 0);
+    atomic_store(&numExpired, 0);
+    atomic_store(&currentEpoch, 1);
+    memset(balanceEpochs, 0, sizeof(balanceEpochs));
+
+    // Free the bank accounts
+    free_accounts();
+}
+
+/* Creates a CHECK request for one account
+ * Inputs:
+ *    acc_id -- The account to check
+ *
+ * Outputs:
+ *    struct request* -- The new request
+*/
+struct request* bank_new_check(int acc_id) {
+    struct request* req = newRequest(REQ_CHECK);
+    req->check_acc_id = acc_id;
+    return req;
+}
+
+/* Creates a TRANS request with room for num_trans transaction pairs
+ *  - The caller fills in transactions[0] through transactions[num_trans - 1]
+ *
+ * Inputs:
+ *    num_trans -- The number of transaction pairs
+ *
+ * Outputs:
+ *    struct request* -- The new request
+*/
+struct request* bank_new_trans(int num_trans) {
+    struct request* req = newRequest(REQ_TRANS);
+    req->num_trans = num_trans;
+    req->transactions = (struct trans*) malloc(num_trans * sizeof(struct trans));
+    return req;
+}
+
+/* Creates an AUDIT request for the total of every balance
+ * Outputs:
+ *    struct request* -- The new request
+*/
+struct request* bank_new_audit() {
+    struct request* req = newRequest(REQ_AUDIT);
+    req->sum_lo = 1;
+    req->sum_hi = numAccounts;
+    return req;
+}
+
+/* Creates a SUM request for the total of an account range
+ *  - A range with no accounts that exist becomes 1 to 0, which is routed like account 1 and totals 0
+ *
+ * Inputs:
+ *    lo -- The first account in the range, clamped to the accounts that exist
+ *    hi -- The last account in the range, clamped to the accounts that exist
+ *
+ * Outputs:
+ *    struct request* -- The new request
+*/
+struct request* bank_new_sum(int lo, int hi) {
+    struct request* req = newRequest(REQ_SUM);
+    req->sum_lo = lo < 1 ? 1 : lo;
+    req->sum_hi = hi > numAccounts ? numAccounts : hi;
+    if (req->sum_lo > req->sum_hi) {
+        req->sum_lo = 1;
+        req->sum_hi = 0;
+    }
+    return req;
+}
+
+/* Creates a BATCH request with room for num_reqs members
+ *  - The members are kept in one contiguous block and run in the order they are added
+ *
+ * Inputs:
+ *    num_reqs -- The number of members, from 1 to MAX_BATCH
+ *
+ * Outputs:
+ *    struct request* -- The new request, NULL if num_reqs is out of range or there is no memory for it
+*/
+struct request* bank_new_batch(int num_reqs) {
+    if (num_reqs < 1 || num_reqs > MAX_BATCH) {
+        return NULL;
+    }
+    struct request* members = (struct request*) calloc(num_reqs, sizeof(struct request));
+    if (members == NULL) {
+        return NULL;
+    }
+    struct request* req = newRequest(REQ_BATCH);
+    req->batch = members;
+    req->batch_cap = num_reqs;
+    return req;
+}
+
+/* Moves a CHECK or TRANS request into the next member of a BATCH request
+ *  - The batch takes over everything req holds and req itself is freed
+ *
+ * Inputs:
+ *    batch -- The BATCH request
+ *    req -- The request to add, not yet submitted
+ *
+ * Outputs:
+ *    int -- 1 if it was added; 0 if the batch is full or req is not a CHECK or TRANS, leaving req with the caller
+*/
+int bank_batch_add(struct request* batch, struct request* req) {
+    if (batch->num_batch == batch->batch_cap || (req->type != REQ_CHECK && req->type != REQ_TRANS)) {
+        return 0;
+    }
+    batch->batch[batch->num_batch++] = *req;
+    free(req);
+    return 1;
+}
+
+/* Gives a request a deadline, after which it expires instead of running
+ * Inputs:
+ *    req -- The request
+ *    timeout_ms -- Milliseconds from now until the deadline, 0 or less for no deadline
+*/
+void bank_set_deadline(struct request* req, int timeout_ms) {
+    req->deadline = timeout_ms > 0 ? monotonicNs() + timeout_ms * 1000000LL : 0;
+}
+
+/* Frees a request that was never submitted
+ * Inputs:
+ *    req -- The request to free
+*/
+void bank_free_request(struct request* req) {
+    for (int i = 0; i < req->num_batch; i++) {
+        free(req->batch[i].transactions);
+    }
+    free(req->batch);
+    free(req->results);
+    free(req->partitions);
+    free(req->transactions);
+    free(req);
+}
+
+/* Submits one request
+ * Inputs:
+ *    req -- The request to submit; the engine frees it once it completes
+*/
+void bank_submit(struct request* req) {
+    bank_submit_batch(&req, 1);
+}
+
+/* Submits a batch of requests
+ *  - Requests turned away here are completed on the calling thread, so the callback may run before this returns
+ *  - A request naming an account that does not exist is completed as REJECT bad_account instead
+ *  - In the normal mode the batch goes into the job queue SUBMIT_CHUNK requests per lock
+ *  - In partitioned mode each request is routed to the worker owning its accounts
+ *
+ * Inputs:
+ *    reqs -- The requests to submit, in order; the engine frees each once it completes
+ *    numReqs -- The number of requests
+*/
+void bank_submit_batch(struct request* reqs[], int numReqs) {
+    if (numReqs <= 0) {
+        return;
+    }
+
+    // Count the requests as pending until they complete
+    atomic_fetch_add(&numPending, numReqs);
+
+    // In partitioned mode, hand each request to the worker owning its accounts
+    if (partitionMode) {
+        for (int i = 0; i < numReqs; i++) {
+            if (!validAccounts(reqs[i])) {
+                rejectRequest(reqs[i], "bad_account");
+            } else {
+                routeRequest(reqs[i]);
+            }
+        }
+        return;
+    }
+
+    // Requests of the chunk with valid accounts, and those turned away by admission control, completed once the queue is unlocked
+    struct request* validRequests[SUBMIT_CHUNK];
+    struct request* shedRequests[SUBMIT_CHUNK];
+    struct request* rejectedRequests[SUBMIT_CHUNK];
+
+    for (int start = 0; start < numReqs; start += SUBMIT_CHUNK) {
+        int end = start + SUBMIT_CHUNK < numReqs ? start + SUBMIT_CHUNK : numReqs;
+        int numValid = 0, numShedHere = 0, numRejectedHere = 0;
+
+        // Turn away the requests with accounts that do not exist before taking the lock
+        for (int i = start; i < end; i++) {
+            if (!validAccounts(reqs[i])) {
+                rejectRequest(reqs[i], "bad_account");
+            } else {
+                validRequests[numValid++] = reqs[i];
+            }
+        }
+
+        // Lock the queue
+        pthread_mutex_lock(&queueMutex);
+
+        for (int i = 0; i < numValid; i++) {
+            // Make sure there is room for the request
+            int admitted;
+            struct request* shedRequest = admitRequest(&jobQueue, &queueMutex, &queueNotFull, validRequests[i], &admitted);
+            if (shedRequest != NULL) {
+                shedRequests[numShedHere++] = shedRequest;
+            }
+            if (!admitted) {
+                rejectedRequests[numRejectedHere++] = validRequests[i];
+                continue;
+            }
+
+            // Add the request to the queue and wake a worker
+            queuePush(&jobQueue, validRequests[i]);
+            noteQueueDepth(jobQueue.num_jobs);
+            pthread_cond_signal(&startWorker);
+        }
+
+        // Unlock the queue
+        pthread_mutex_unlock(&queueMutex);
+
+        // Complete any request of the chunk that did not make it into the queue
+        for (int i = 0; i < numShedHere; i++) {
+            rejectRequest(shedRequests[i], "shed");
+        }
+        for (int i = 0; i < numRejectedHere; i++) {
+            rejectRequest(rejectedRequests[i], "queue_full");
+        }
+    }
+}
+
+/* Takes results off the completion queue (only used when there is no completion callback)
+ * Inputs:
+ *    results -- Filled with up to max results
+ *    max -- The most results to take
+ *    wait -- 1 to wait for a result if none are ready and requests are still pending
+ *
+ * Outputs:
+ *    int -- The number of results taken
+*/
+int bank_poll(struct bank_result results[], int max, int wait) {
+    int numResults = 0;
+    pthread_mutex_lock(&pendingMutex);
+    // Wait for a result if asked to and one can still arrive
+    while (wait && completionHead == NULL && atomic_load(&numPending) > 0) {
+        pthread_cond_wait(&pendingDone, &pendingMutex);
+    }
+    // Take as many results as fit
+    while (completionHead != NULL && numResults < max) {
+        struct completion* done = completionHead;
+        completionHead = done->next;
+        if (completionHead == NULL) {
+            completionTail = NULL;
+        }
+        results[numResults++] = done->result;
+        free(done);
+    }
+    pthread_mutex_unlock(&pendingMutex);
+    return numResults;
+}
+
+/* Gets the admission stats for the job queue
+ *  - Depth is the number of requests currently waiting across all queues
+ *
+ * Inputs:
+ *    stats -- Filled with the current stats
+*/
+void bank_get_stats(struct bank_stats* stats) {
+    int depth = 0;
+    // Add up the depth of every queue in use
+    if (partitionMode) {
+        for (int i = 0; i < numWorkers; i++) {
+            pthread_mutex_lock(&partitions[i].mutex);
+            depth += partitions[i].jobs.num_jobs;
+            pthread_mutex_unlock(&partitions[i].mutex);
+        }
+    } else {
+        pthread_mutex_lock(&queueMutex);
+        depth = jobQueue.num_jobs;
+        pthread_mutex_unlock(&queueMutex);
+    }
+    stats->depth = depth;
+    stats->max_depth = atomic_load(&maxQueueDepth);
+    stats->accepted = atomic_load(&numAccepted);
+    stats->rejected = atomic_load(&numRejected);
+    stats->shed = atomic_load(&numShed);
+    stats->expired = atomic_load(&numExpired);
+}
+
+/* Allocates a request with its generic data filled in
+ * Inputs:
+ *    type -- The REQ_* type of the request
+ *
+ * Outputs:
+ *    struct request* -- The new request, with the start time set to now
+*/
+static struct request* newRequest(int type) {
+    struct request* req = (struct request*) calloc(1, sizeof(struct request));
+    req->type = type;
+    gettimeofday(&req->starttime, NULL);
+    return req;
+}
+
+/* Holds all of the worker threads
+ *  - Pulls jobs off the queue until the engine shuts down
+ *  - Calls the appropriate helper method to perform the request
+ *
+ * Inputs:
+ *    arg -- The publisher of this worker
+*/
+static void *workers(void *arg) {
+    myPublisher = (struct publisher*) arg;
+
+    // Loop until shutdown
+    while (1) {
+        // Lock the queue mutex
+        pthread_mutex_lock(&queueMutex);
+        // Wait for the associated conditional variable to be signaled
+        while (jobQueue.num_jobs == 0 && !shutdownFlag) {
+            pthread_cond_wait(&startWorker, &queueMutex);
+        }
+        // Exit once shut down and out of work
+        if (jobQueue.num_jobs == 0) {
+            pthread_mutex_unlock(&queueMutex);
+            return NULL;
+        }
+        // Grab the next job off the queue
+        struct request* nextRequest = queuePop(&jobQueue);
+        // Let the submitter know there is room in the queue
+        pthread_cond_signal(&queueNotFull);
+        // Unlock the queue mutex
+        pthread_mutex_unlock(&queueMutex);
+        // Call helper functions - unless the request already missed its deadline
+        if (!expireIfLate(nextRequest)) {
+            runRequest(nextRequest);
+        }
+        completeRequest(nextRequest);
+    }
+}
+
+/* Calls the helper that performs a request
+ * Inputs:
+ *    req -- The request to run
+*/
+static void runRequest(struct request* req) {
+    if (req->type == REQ_CHECK) {
+        // It must be a balance check - call the helper
+        balCheck(req);
+    } else if (req->type == REQ_TRANS) {
+        // It must be a transaction - call the helper
+        transactionReq(req);
+    } else if (req->type == REQ_BATCH) {
+        // It must be a batch - call the helper
+        batchReq(req);
+    } else {
+        // It must be an audit or range sum - call the helper
+        sumReq(req);
+    }
+}
+
+/* Returns the partition that owns an account
+ *  - Accounts are split into contiguous ranges so each owner touches its own slice of the bank
+ *
+ * Inputs:
+ *    acc_id -- The account ID to look up
+ *
+ * Outputs:
+ *    int -- The index of the owning partition
+*/
+static int partitionOf(int acc_id) {
+    return (int) ((long) (acc_id - 1) * numWorkers / numAccounts);
+}
+
+/* Routes a new request to the partition that will run it (partitioned mode only)
+ *  - CHECK requests and single-partition TRANS and BATCH requests go straight to the owner
+ *  - Cross-partition TRANS and BATCH requests go to the lowest partition touched, which coordinates them
+ *
+ * Inputs:
+ *    newRequest -- The request to route
+*/
+static void routeRequest(struct request* newRequest) {
+    // Build the list of partitions touched by the request
+    // AUDIT and SUM read the versioned balances, so they only need a worker and not the partitions they cover
+    if (newRequest->type == REQ_CHECK || newRequest->type == REQ_AUDIT || newRequest->type == REQ_SUM) {
+        newRequest->partitions = (int*) malloc(sizeof(int));
+        newRequest->partitions[0] = partitionOf(newRequest->type == REQ_CHECK ? newRequest->check_acc_id : newRequest->sum_lo);
+        newRequest->num_partitions = 1;
+    } else {
+        // Every account of a TRANS, or of every member of a BATCH
+        struct request* members = newRequest->type == REQ_BATCH ? newRequest->batch : newRequest;
+        int numMembers = newRequest->type == REQ_BATCH ? newRequest->num_batch : 1;
+        int numAccs = 0;
+        for (int m = 0; m < numMembers; m++) {
+            numAccs += members[m].type == REQ_CHECK ? 1 : members[m].num_trans;
+        }
+        newRequest->partitions = (int*) malloc((numAccs + 1) * sizeof(int));
+        numAccs = 0;
+        for (int m = 0; m < numMembers; m++) {
+            if (members[m].type == REQ_CHECK) {
+                newRequest->partitions[numAccs++] = partitionOf(members[m].check_acc_id);
+            }
+            for (int i = 0; i < members[m].num_trans; i++) {
+                newRequest->partitions[numAccs++] = partitionOf(members[m].transactions[i].acc_id);
+            }
+        }
+        // An empty batch still needs a worker
+        if (numAccs == 0) {
+            newRequest->partitions[numAccs++] = 0;
+        }
+        // Sort the partitions and remove duplicates so they are reserved in ascending order
+        quickSort(newRequest->partitions, 0, numAccs - 1);
+        int numUnique = 0;
+        for (int i = 0; i < numAccs; i++) {
+            if (numUnique == 0 || newRequest->partitions[numUnique - 1] != newRequest->partitions[i]) {
+                newRequest->partitions[numUnique++] = newRequest->partitions[i];
+            }
+        }
+        newRequest->num_partitions = numUnique;
+    }
+    newRequest->num_reserved = 0;
+    newRequest->next = NULL;
+
+    // Lock the job queue of the lowest partition touched and make sure there is room
+    struct partition* owner = &partitions[newRequest->partitions[0]];
+    pthread_mutex_lock(&owner->mutex);
+    int admitted;
+    struct request* shedRequest = admitRequest(&owner->jobs, &owner->mutex, &owner->notFull, newRequest, &admitted);
+
+    // Add the request to the job queue
+    if (admitted) {
+        queuePush(&owner->jobs, newRequest);
+        noteQueueDepth(owner->jobs.num_jobs);
+        pthread_cond_signal(&owner->wake);
+    }
+    pthread_mutex_unlock(&owner->mutex);
+
+    // Complete any request that did not make it into the queue
+    if (shedRequest != NULL) {
+        rejectRequest(shedRequest, "shed");
+    }
+    if (!admitted) {
+        rejectRequest(newRequest, "queue_full");
+    }
+}
+
+/* Sends a message to the mailbox of another partition
+ * Inputs:
+ *    to -- The partition receiving the message
+ *    type -- The MSG_* type of the message
+ *    from -- The partition sending the message
+ *    req -- The request the message is about
+*/
+static void sendMessage(int to, int type, int from, struct request* req) {
+    // Build the message
+    struct message* msg = (struct message*) malloc(sizeof(struct message));
+    msg->next = NULL;
+    msg->type = type;
+    msg->from = from;
+    msg->req = req;
+
+    // Append it to the receiver's mailbox and wake the receiver
+    struct partition* part = &partitions[to];
+    pthread_mutex_lock(&part->mutex);
+    if (part->msgHead == NULL) {
+        part->msgHead = msg;
+    } else {
+        part->msgTail->next = msg;
+    }
+    part->msgTail = msg;
+    pthread_cond_signal(&part->wake);
+    pthread_mutex_unlock(&part->mutex);
+}
+
+/* Advances the reservation of a cross-partition request on its coordinator
+ *  - Phase 1: partitions are reserved one at a time in ascending order, so two coordinators can never wait on each other
+ *  - Phase 2: once all are reserved the request runs and every other partition is released
+ *
+ * Inputs:
+ *    part -- The coordinating partition
+ *    req -- The cross-partition request
+*/
+static void reserveNext(struct partition* part, struct request* req) {
+    // Ask the next partition to reserve itself if any are left
+    if (req->num_reserved < req->num_partitions) {
+        sendMessage(req->partitions[req->num_reserved], MSG_PREPARE, part->id, req);
+        return;
+    }
+
+    // Every partition is reserved, so the accounts can be touched directly
+    runRequest(req);
+
+    // Release the other partitions and the coordinator itself
+    for (int i = 1; i < req->num_partitions; i++) {
+        sendMessage(req->partitions[i], MSG_RELEASE, part->id, req);
+    }
+    part->holder = NULL;
+    completeRequest(req);
+}
+
+/* Hands the result of a request to the completion callback or the completion queue
+ * Inputs:
+ *    req -- The request that finished
+ *    status -- The RESULT_* status
+ *    value -- Balance, total or failing account, depending on the request
+ *    reason -- Why the request was rejected, NULL otherwise
+*/
+static void reportResult(struct request* req, int status, long long value, const char* reason) {
+    // Get the end time
+    gettimeofday(&req->endtime, NULL);
+
+    // Build the result
+    struct bank_result result;
+    result.request_id = req->request_id;
+    result.type = req->type;
+    result.status = status;
+    result.value = value;
+    result.reason = reason;
+    result.starttime = req->starttime;
+    result.endtime = req->endtime;
+    result.user_data = req->user_data;
+    result.num_batch = req->num_batch;
+    result.batch_results = req->results;
+
+    // Call the callback if there is one - the member results are freed with the request
+    if (resultCallback != NULL) {
+        resultCallback(&result, callbackArg);
+        return;
+    }
+
+    // The member results now belong to the poller
+    req->results = NULL;
+
+    // Otherwise add the result to the completion queue and wake any poller
+    struct completion* done = (struct completion*) malloc(sizeof(struct completion));
+    done->next = NULL;
+    done->result = result;
+    pthread_mutex_lock(&pendingMutex);
+    if (completionHead == NULL) {
+        completionHead = done;
+    } else {
+        completionTail->next = done;
+    }
+    completionTail = done;
+    pthread_cond_broadcast(&pendingDone);
+    pthread_mutex_unlock(&pendingMutex);
+}
+
+/* Frees a finished request and wakes anyone draining the engine if nothing is left pending
+ * Inputs:
+ *    req -- The finished request
+*/
+static void completeRequest(struct request* req) {
+    // Free the request's memory
+    bank_free_request(req);
+
+    // Decrement the pending count and wake the waiters at zero
+    if (atomic_fetch_sub(&numPending, 1) == 1) {
+        pthread_mutex_lock(&pendingMutex);
+        pthread_cond_broadcast(&pendingDone);
+        pthread_mutex_unlock(&pendingMutex);
+    }
+}
+
+/* Pins a thread to a single core, wrapping around if there are more threads than cores
+ * Inputs:
+ *    thread -- The thread to pin
+ *    core -- The core index to pin it to
+*/
+static void pinThread(pthread_t thread, int core) {
+    // Get the number of online cores
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numCores < 1) {
+        return;
+    }
+    // Restrict the thread to the single core - failure only costs locality, so it is ignored
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core % numCores, &cpus);
+    pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+}
+
+/* Holds a partition owner thread (partitioned mode only)
+ *  - Runs requests for its own accounts without any account locks
+ *  - Handles reservation messages for cross-partition requests
+ *  - While reserved, only GRANT and RELEASE messages are handled; new jobs and PREPAREs wait
+ *
+ * Inputs:
+ *    arg -- The partition owned by this thread
+*/
+static void *partitionWorker(void *arg) {
+    struct partition* part = (struct partition*) arg;
+    myPublisher = &publishers[part->id];
+
+    // Loop until shutdown
+    while (1) {
+        struct message* msg = NULL;
+        struct request* job = NULL;
+
+        // Lock the partition and wait for something that can be handled now
+        pthread_mutex_lock(&part->mutex);
+        while (1) {
+            // Look for the first message that can be handled in the current state
+            struct message* prev = NULL;
+            for (msg = part->msgHead; msg != NULL; prev = msg, msg = msg->next) {
+                if (msg->type != MSG_PREPARE || part->holder == NULL) {
+                    break;
+                }
+            }
+            if (msg != NULL) {
+                // Unlink the message from the mailbox
+                if (prev == NULL) {
+                    part->msgHead = msg->next;
+                } else {
+                    prev->next = msg->next;
+                }
+                if (part->msgTail == msg) {
+                    part->msgTail = prev;
+                }
+                break;
+            }
+            // Otherwise take the next job if the partition is free
+            if (part->holder == NULL && part->jobs.num_jobs > 0) {
+                job = queuePop(&part->jobs);
+                // Let the submitter know there is room in the queue
+                pthread_cond_signal(&part->notFull);
+                break;
+            }
+            // Exit once shut down - the engine is drained first, so nothing is left
+            if (shutdownFlag) {
+                pthread_mutex_unlock(&part->mutex);
+                return NULL;
+            }
+            pthread_cond_wait(&part->wake, &part->mutex);
+        }
+        pthread_mutex_unlock(&part->mutex);
+
+        if (msg != NULL) {
+            // Handle the message
+            if (msg->type == MSG_PREPARE) {
+                // Reserve this partition and tell the coordinator
+                part->holder = msg->req;
+                sendMessage(msg->from, MSG_GRANT, part->id, msg->req);
+            } else if (msg->type == MSG_GRANT) {
+                // One more partition is reserved - keep going
+                msg->req->num_reserved++;
+                reserveNext(part, msg->req);
+            } else {
+                // The coordinator is done with this partition
+                part->holder = NULL;
+            }
+            free(msg);
+        } else if (expireIfLate(job)) {
+            // It sat in the queue too long - nothing to reserve or run
+            completeRequest(job);
+        } else if (job->num_partitions > 1) {
+            // Cross-partition request - reserve this partition and start reserving the rest
+            part->holder = job;
+            job->num_reserved = 1;
+            reserveNext(part, job);
+        } else {
+            // Single-partition request - run it directly
+            runRequest(job);
+            completeRequest(job);
+        }
+    }
+}
+
+/* Applies the admission policy before a request is added to a job queue
+ *  - Must be called with the queue's mutex held
+ *  - Does nothing when the queue is unbounded or has room
+ *
+ * Inputs:
+ *    q -- The job queue the request is going into
+ *    mutex -- The mutex protecting q
+ *    notFull -- The conditional signaled when a job leaves q
+ *    newRequest -- The request being added
+ *    admitted -- Set to 1 if newRequest may be added, 0 if it was rejected
+ *
+ * Outputs:
+ *    struct request* -- The queued request that was shed to make room, otherwise NULL
+*/
+static struct request* admitRequest(struct queue* q, pthread_mutex_t* mutex, pthread_cond_t* notFull, struct request* newRequest, int* admitted) {
+    *admitted = 1;
+    // Nothing to do if the queue is unbounded or has room
+    if (queueCapacity <= 0 || q->num_jobs < queueCapacity) {
+        atomic_fetch_add(&numAccepted, 1);
+        return NULL;
+    }
+
+    if (queuePolicy == POLICY_REJECT) {
+        // Turn the new request away
+        *admitted = 0;
+        atomic_fetch_add(&numRejected, 1);
+        return NULL;
+    } else if (queuePolicy == POLICY_SHED) {
+        // Drop a queued request to make room for the new one
+        struct request* oldest = queueShed(q);
+        atomic_fetch_add(&numShed, 1);
+        atomic_fetch_add(&numAccepted, 1);
+        return oldest;
+    }
+
+    // Wait for a worker to take a job off the queue
+    while (q->num_jobs >= queueCapacity) {
+        pthread_cond_wait(notFull, mutex);
+    }
+    atomic_fetch_add(&numAccepted, 1);
+    return NULL;
+}
+
+/* Records a new queue depth in the max depth stat
+ * Inputs:
+ *    depth -- The depth of a queue right after a job was added
+*/
+static void noteQueueDepth(int depth) {
+    int seen = atomic_load(&maxQueueDepth);
+    while (depth > seen && !atomic_compare_exchange_weak(&maxQueueDepth, &seen, depth));
+}
+
+/* Adds a request to a job queue
+ *  - Must be called with the queue's mutex held
+ *
+ * Inputs:
+ *    q -- The job queue
+ *    req -- The request to add
+*/
+static void queuePush(struct queue* q, struct request* req) {
+    q->num_jobs++;
+    req->next = NULL;
+
+    // No deadline - add it to the end of the list
+    if (req->deadline == 0) {
+        if (q->head == NULL) {
+            q->head = req;
+        } else {
+            q->tail->next = req;
+        }
+        q->tail = req;
+        return;
+    }
+
+    // Grow the heap if it is full
+    if (q->heap_size == q->heap_cap) {
+        q->heap_cap = q->heap_cap ? q->heap_cap * 2 : 64;
+        q->heap = (struct request**) realloc(q->heap, q->heap_cap * sizeof(struct request*));
+    }
+
+    // Add it to the bottom of the heap and move it up past any later deadlines
+    int i = q->heap_size++;
+    q->heap[i] = req;
+    while (i > 0 && q->heap[(i - 1) / 2]->deadline > q->heap[i]->deadline) {
+        heapSwap(q, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/* Takes the next request off a job queue, earliest deadline first
+ *  - Must be called with the queue's mutex held and at least one job queued
+ *
+ * Inputs:
+ *    q -- The job queue
+ *
+ * Outputs:
+ *    struct request* -- The request with the earliest deadline, or the oldest if none have one
+*/
+static struct request* queuePop(struct queue* q) {
+    q->num_jobs--;
+
+    // Nothing with a deadline - take the head of the list
+    if (q->heap_size == 0) {
+        struct request* req = q->head;
+        q->head = req->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        return req;
+    }
+
+    // Take the top of the heap, move the last request there and push it back down
+    struct request* req = q->heap[0];
+    q->heap[0] = q->heap[--q->heap_size];
+    int i = 0;
+    while (1) {
+        int earliest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < q->heap_size && q->heap[left]->deadline < q->heap[earliest]->deadline) {
+            earliest = left;
+        }
+        if (right < q->heap_size && q->heap[right]->deadline < q->heap[earliest]->deadline) {
+            earliest = right;
+        }
+        if (earliest == i) {
+            break;
+        }
+        heapSwap(q, i, earliest);
+        i = earliest;
+    }
+    return req;
+}
+
+/* Takes a request off a full job queue to make room for a new one
+ *  - The oldest request without a deadline goes first, since it would be run last
+ *  - If every request has a deadline, the earliest goes, since it is the most likely to expire anyway
+ *
+ * Inputs:
+ *    q -- The job queue
+ *
+ * Outputs:
+ *    struct request* -- The request that was taken off
+*/
+static struct request* queueShed(struct queue* q) {
+    if (q->head != NULL) {
+        struct request* req = q->head;
+        q->head = req->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        q->num_jobs--;
+        return req;
+    }
+    return queuePop(q);
+}
+
+/* Swaps two requests in a job queue's heap
+ * Inputs:
+ *    q -- The job queue
+ *    i -- Index of the first request
+ *    j -- Index of the second request
+*/
+static void heapSwap(struct queue* q, int i, int j) {
+    struct request* temp = q->heap[i];
+    q->heap[i] = q->heap[j];
+    q->heap[j] = temp;
+}
+
+/* Completes a request as EXPIRED if its deadline has passed, without touching any account
+ *  - The caller still frees the request with completeRequest
+ *
+ * Inputs:
+ *    req -- The request a worker just took off a queue
+ *
+ * Outputs:
+ *    int -- 1 if the request expired; 0 if it should run
+*/
+static int expireIfLate(struct request* req) {
+    if (req->deadline == 0 || monotonicNs() <= req->deadline) {
+        return 0;
+    }
+    atomic_fetch_add(&numExpired, 1);
+    reportResult(req, RESULT_EXPIRED, 0, NULL);
+    return 1;
+}
+
+/* Returns the current monotonic time
+ * Outputs:
+ *    long long -- CLOCK_MONOTONIC in nanoseconds
+*/
+static long long monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Completes a request as REJECT without touching any account
+ * Inputs:
+ *    req -- The request that was not run
+ *    reason -- Why the request was not run
+*/
+static void rejectRequest(struct request* req, const char* reason) {
+    reportResult(req, RESULT_REJECT, 0, reason);
+    completeRequest(req);
+}
+
+/* Checks that every account a CHECK, TRANS or BATCH request touches exists
+ *  - AUDIT and SUM ranges are clamped when they are created, so they always pass
+ *
+ * Inputs:
+ *    req -- The request to check
+ *
+ * Outputs:
+ *    int -- 1 if every account is from 1 to the number of accounts; 0 otherwise
+*/
+static int validAccounts(struct request* req) {
+    if (req->type == REQ_CHECK) {
+        return req->check_acc_id >= 1 && req->check_acc_id <= numAccounts;
+    }
+    for (int i = 0; i < req->num_trans; i++) {
+        if (req->transactions[i].acc_id < 1 || req->transactions[i].acc_id > numAccounts) {
+            return 0;
+        }
+    }
+    for (int m = 0; m < req->num_batch; m++) {
+        if (!validAccounts(&req->batch[m])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Performs a balance check on the given request
+ * Inputs:
+ *    nextRequest -- The request struct that holds the balance check
+*/
+static void balCheck(struct request* nextRequest) {
+    // Lock the account's mutex - not needed when the owning partition runs the check
+    if (!partitionMode) {
+        pthread_mutex_lock(&accountMutexes[nextRequest->check_acc_id - 1]);
+    }
+    // Get the balance of the account
+    int bal = read_account(nextRequest->check_acc_id);
+    // Unlock the account's mutex
+    if (!partitionMode) {
+        pthread_mutex_unlock(&accountMutexes[nextRequest->check_acc_id - 1]);
+    }
+
+    // Report the balance
+    reportResult(nextRequest, RESULT_OK, bal, NULL);
+}
+
+/* Performs a transaction request
+ * Inputs:
+ *    nextRequest -- The request struct that holds the transaction
+*/
+static void transactionReq(struct request* nextRequest) {
+    // Get a list of all accounts affected
+    int accountList[nextRequest->num_trans];
+    for (int i = 0; i < nextRequest->num_trans; i++) {
+        accountList[i] = nextRequest->transactions[i].acc_id;
+    }
+
+    // Sort the account IDs
+    quickSort(accountList, 0, nextRequest->num_trans - 1);
+
+    // Lock all associated accounts in ascending order
+    // In partitioned mode every touched partition is already owned or reserved, so no locks are needed
+    for (int i = 0; i < nextRequest->num_trans && !partitionMode; i++) {
+        // Lock the account's mutex
+        pthread_mutex_lock(&accountMutexes[accountList[i] - 1]);
+    }
+
+    // Apply the transaction if no balance would go negative
+    int invalidAccID = 0;
+    int invalidBalance = !applyTransaction(nextRequest, &invalidAccID);
+
+    // Unlock all associated accounts in ascending order
+    for (int i = 0; i < nextRequest->num_trans && !partitionMode; i++) {
+        // Unlock the account's mutex
+        pthread_mutex_unlock(&accountMutexes[accountList[i] - 1]);
+    }
+
+    // Depending on the state of the invalidBalance flag, report the outcome
+    if (!invalidBalance) {
+        reportResult(nextRequest, RESULT_OK, 0, NULL);
+    } else {
+        reportResult(nextRequest, RESULT_ISF, invalidAccID, NULL);
+    }
+}
+
+/* Applies a transaction to the accounts unless it would leave one negative
+ *  - Must be called with every account of the transaction locked or reserved
+ *
+ * Inputs:
+ *    req -- The transaction request
+ *    invalidAccID -- Set to the account that would go negative, if one would
+ *
+ * Outputs:
+ *    int -- 1 if the transaction was applied; 0 if it would have left an account negative
+*/
+static int applyTransaction(struct request* req, int* invalidAccID) {
+    // Loop through the transactions
+    for (int i = 0; i < req->num_trans; i++) {
+        if ((read_account(req->transactions[i].acc_id) + req->transactions[i].amount) < 0) {
+            // Set the invalid account ID
+            *invalidAccID = req->transactions[i].acc_id;
+            return 0;
+        }
+    }
+
+    // No invalid balance was found, so perform the transactions
+    for (int i = 0; i < req->num_trans; i++) {
+        // Write the new value to the account
+        write_account(req->transactions[i].acc_id, read_account(req->transactions[i].acc_id) + req->transactions[i].amount);
+    }
+    // Publish the new balances while the accounts are still held
+    publishBalances(req);
+    return 1;
+}
+
+/* Performs a BATCH request
+ *  - Every account the members touch is locked once, in ascending order, for the whole batch
+ *  - Members run in order, each seeing the ones before it, and a member with ISF does not stop the rest
+ *  - One result is reported for the batch, holding the result of every member
+ *  - With no memory for the member results, the batch is reported as REJECT no_memory without running
+ *
+ * Inputs:
+ *    nextRequest -- The request struct that holds the batch
+*/
+static void batchReq(struct request* nextRequest) {
+    // Make room for the member results before touching any account
+    nextRequest->results = (struct bank_result*) calloc(nextRequest->num_batch + 1, sizeof(struct bank_result));
+    if (nextRequest->results == NULL) {
+        reportResult(nextRequest, RESULT_REJECT, 0, "no_memory");
+        return;
+    }
+
+    // Mark every account touched - scanning the marks gives them sorted without duplicates
+    char touched[MAX_ACCOUNTS];
+    memset(touched, 0, numAccounts);
+    for (int m = 0; m < nextRequest->num_batch; m++) {
+        struct request* member = &nextRequest->batch[m];
+        if (member->type == REQ_CHECK && member->check_acc_id >= 1 && member->check_acc_id <= numAccounts) {
+            touched[member->check_acc_id - 1] = 1;
+        }
+        for (int i = 0; i < member->num_trans; i++) {
+            if (member->transactions[i].acc_id >= 1 && member->transactions[i].acc_id <= numAccounts) {
+                touched[member->transactions[i].acc_id - 1] = 1;
+            }
+        }
+    }
+
+    // Lock the accounts in ascending order - not needed when every partition is owned or reserved
+    for (int i = 0; i < numAccounts && !partitionMode; i++) {
+        if (touched[i]) {
+            pthread_mutex_lock(&accountMutexes[i]);
+        }
+    }
+
+    // Run the members
+    int numFailed = 0;
+    for (int m = 0; m < nextRequest->num_batch; m++) {
+        struct request* member = &nextRequest->batch[m];
+        struct bank_result* result = &nextRequest->results[m];
+        result->request_id = member->request_id;
+        result->type = member->type;
+        result->user_data = member->user_data;
+        result->starttime = nextRequest->starttime;
+        if (member->type == REQ_CHECK) {
+            result->status = RESULT_OK;
+            result->value = read_account(member->check_acc_id);
+        } else {
+            int invalidAccID = 0;
+            if (applyTransaction(member, &invalidAccID)) {
+                result->status = RESULT_OK;
+            } else {
+                result->status = RESULT_ISF;
+                result->value = invalidAccID;
+                numFailed++;
+            }
+        }
+    }
+
+    // Unlock the accounts in ascending order
+    for (int i = 0; i < numAccounts && !partitionMode; i++) {
+        if (touched[i]) {
+            pthread_mutex_unlock(&accountMutexes[i]);
+        }
+    }
+
+    // Every member finished with the batch
+    struct timeval endtime;
+    gettimeofday(&endtime, NULL);
+    for (int m = 0; m < nextRequest->num_batch; m++) {
+        nextRequest->results[m].endtime = endtime;
+    }
+    reportResult(nextRequest, RESULT_OK, numFailed, NULL);
+}
+
+/* Publishes a committed transaction to the versioned balances
+ *  - Must be called while the request's accounts are still locked or reserved
+ *  - The worker's publish sequence is odd while the epoch is read and used, so an audit that moves the epoch
+ *    meanwhile waits for this commit instead of summing it halfway through
+ *
+ * Inputs:
+ *    req -- The committed transaction request
+*/
+static void publishBalances(struct request* req) {
+    // Mark the commit in flight before reading the epoch - an audit either sees the mark or has already moved the epoch
+    unsigned int seq = atomic_load_explicit(&myPublisher->seq, memory_order_relaxed);
+    atomic_store(&myPublisher->seq, seq + 1);
+    unsigned int epoch = atomic_load(&currentEpoch);
+    for (int i = 0; i < req->num_trans; i++) {
+        int idx = req->transactions[i].acc_id - 1;
+        // First write in this epoch - save the balance a running audit may still need
+        if (balanceEpochs[idx] != epoch) {
+            prevBalances[idx] = balances[idx];
+            atomic_thread_fence(memory_order_release);
+            balanceEpochs[idx] = epoch;
+            atomic_thread_fence(memory_order_release);
+        }
+        balances[idx] += req->transactions[i].amount;
+    }
+    atomic_store_explicit(&myPublisher->seq, seq + 2, memory_order_release);
+}
+
+/* Performs an AUDIT or SUM request over a consistent view of the balances
+ *  - Starts a new epoch, so every commit before it is counted and every commit after it is not
+ *  - Commits are never held back - the audit only waits for the ones already publishing when the epoch moves
+ *
+ * Inputs:
+ *    nextRequest -- The request struct that holds the account range
+*/
+static void sumReq(struct request* nextRequest) {
+    int lo = nextRequest->sum_lo - 1, hi = nextRequest->sum_hi;
+    long long total = 0;
+
+    // Only one audit at a time, so the epoch cannot move again until this one is done
+    pthread_mutex_lock(&auditMutex);
+
+    // Start a new epoch, then wait for every commit that may have read the old one to finish publishing
+    unsigned int snapshot = atomic_fetch_add(&currentEpoch, 1);
+    for (int i = 0; i < numPublishers; i++) {
+        unsigned int seq = atomic_load(&publishers[i].seq);
+        while ((seq & 1) && atomic_load_explicit(&publishers[i].seq, memory_order_acquire) == seq) {
+            sched_yield();
+        }
+    }
+
+    if (lo < hi) {
+        // Copy the balances before the epochs - a balance read here that is newer than the snapshot
+        // always comes with a newer epoch below, since commits write the epoch before the balance
+        memcpy(&auditBalances[lo], &balances[lo], (hi - lo) * sizeof(int));
+        atomic_thread_fence(memory_order_acquire);
+        memcpy(&auditEpochs[lo], &balanceEpochs[lo], (hi - lo) * sizeof(unsigned int));
+        atomic_thread_fence(memory_order_acquire);
+
+        // Add up the snapshot - branch-free so the compiler vectorizes it over the contiguous arrays
+        for (int i = lo; i < hi; i++) {
+            int newer = -(auditEpochs[i] > snapshot);
+            total += (auditBalances[i] & ~newer) | (prevBalances[i] & newer);
+        }
+    }
+    pthread_mutex_unlock(&auditMutex);
+
+    // Report the total
+    reportResult(nextRequest, RESULT_OK, total, NULL);
+}
+
+/* Quicksort -- Sorts the array in ascending order
+ * Inputs:
+ *    arr -- The array to sort
+ *    min -- The minimum index of arr
+ *    max -- The maximum index of arr
+*/
+static void quickSort(int arr[], int min, int max)
+{
+    // When min is less than max
+    if (min < max) {
+        // Get the partition index
+        int returnIdx = partition(arr, min, max);
+
+        // Recursion Calls
+        // Smaller element than pivot goes left and max element goes right
+        quickSort(arr, min, returnIdx - 1);
+        quickSort(arr, returnIdx + 1, max);
+    }
+}
+
+/* Partitions the array based on min and max
+ * Inputs:
+ *    arr -- The array to partition
+ *    min -- The minimum index of arr
+ *    max -- The maxmimum index of arr
+ *
+ * Outputs:
+ *    int -- Returns the partition index
+*/
+static int partition(int arr[], int min, int max)
+{
+    // Choose the pivot as the max index
+    int pivot = arr[max];
+
+    // Index of smaller element and Indicate
+    // the right position of pivot found so far
+    int i = (min - 1);
+
+    for (int j = min; j <= max; j++) {
+        // If current element is smaller than the pivot
+        if (arr[j] < pivot) {
+            // Increment index of smaller element
+            i++;
+            // Swap the values
+            swap(&arr[i], &arr[j]);
+        }
+    }
+    // Swap the values and return
+    swap(&arr[i + 1], &arr[max]);
+    return (i + 1);
+}
+
+/* Swaps the values at p1 and p2
+ * Inputs:
+ *    p1 -- Value 1 to swap
+ *    p2 -- Value 2 to swap
+*/
+static void swap(int* p1, int* p2)
+{
+    int temp;
+    temp = *p1;
+    *p1 = *p2;
+    *p2 = temp;
+}
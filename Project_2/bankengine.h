@@ -0,0 +1,120 @@
+#ifndef BANKENGINE_H
+#define BANKENGINE_H
+
+#include <sys/time.h>
+
+/* In-process bank engine
+ *  - Holds the job queue, the worker pool, the partitioned executor and the versioned balances
+ *  - Requests are built with the bank_new_* functions, given an ID by the caller and submitted
+ *  - The engine frees every submitted request once it completes
+ *  - Results go to the completion callback, or to the completion queue read by bank_poll if there is none
+ *  - Requests with a deadline are run earliest deadline first, ahead of requests without one
+ *  - A BATCH request runs its CHECK and TRANS members in order with their accounts locked once, and counts as one request
+ *  - One engine per process; bank_init must be called before anything else
+*/
+
+#define MAX_ACCOUNTS 1000
+#define MAX_BATCH 100000 // most members of one BATCH request
+
+// Types of requests
+#define REQ_CHECK 1 // balance check of one account
+#define REQ_TRANS 2 // transaction across one or more accounts
+#define REQ_AUDIT 3 // total of every balance
+#define REQ_SUM 4 // total of the balances in an account range
+#define REQ_BATCH 5 // group of CHECK and TRANS requests run together
+
+// Policies for a full job queue
+#define POLICY_BLOCK 0 // the submitter waits for room in the queue
+#define POLICY_REJECT 1 // the new request is completed as REJECT
+#define POLICY_SHED 2 // the oldest queued request is completed as REJECT to make room
+
+// Result statuses
+#define RESULT_OK 0 // the request ran
+#define RESULT_ISF 1 // the transaction would have left an account negative and was not applied
+#define RESULT_REJECT 2 // the request was turned away by admission control and never ran
+#define RESULT_EXPIRED 3 // the request's deadline passed before a worker got to it, so it never ran
+
+// Structure for a transaction pair
+struct trans {
+    int acc_id; // account ID
+    int amount; // amount to be added, could be positive or negative
+};
+// Structure for a request
+struct request {
+    int request_id; // request ID assigned by the caller, reported back in the result
+    int type; // one of the REQ_* values
+    int check_acc_id; // account ID for a CHECK request
+    int sum_lo, sum_hi; // inclusive account range for an AUDIT or SUM request
+    struct trans * transactions; // array of transaction data
+    int num_trans; // number of accounts in this transaction
+    struct timeval starttime, endtime; // starttime and endtime for TIME
+    long long deadline; // CLOCK_MONOTONIC nanoseconds after which the request expires, 0 for none
+    void * user_data; // caller data, reported back in the result
+    struct request * batch; // contiguous members of a BATCH request, added with bank_batch_add
+    int num_batch, batch_cap; // number of members added and room for them
+
+    // Used by the engine only
+    struct request * next; // pointer to the next request in the list
+    int * partitions; // sorted partitions touched by this request (partitioned mode only)
+    int num_partitions; // number of partitions touched by this request
+    int num_reserved; // number of partitions reserved so far by the coordinator
+    struct bank_result * results; // results of a BATCH request's members, handed over with its result
+};
+// Structure for the result of a completed request
+struct bank_result {
+    int request_id; // ID of the request
+    int type; // REQ_* type of the request
+    int status; // one of the RESULT_* values
+    long long value; // balance for CHECK, total for AUDIT and SUM, failing account for ISF, members with ISF for BATCH
+    const char * reason; // why the request was rejected, for REJECT
+    struct timeval starttime, endtime; // starttime and endtime of the request
+    void * user_data; // caller data from the request
+    int num_batch; // number of members of a BATCH request
+    struct bank_result * batch_results; // result of each member of a BATCH request that ran, NULL otherwise
+                                        // - only valid during the callback; with bank_poll the caller frees it
+};
+// Structure for the admission stats
+struct bank_stats {
+    int depth; // requests currently waiting in the job queues
+    int max_depth; // most requests ever waiting in one job queue
+    int accepted, rejected, shed; // requests let in, turned away when full, and dropped to make room
+    int expired; // requests whose deadline passed before they ran
+};
+// Structure for the engine settings
+struct bank_config {
+    int num_workers; // number of worker threads
+    int num_accounts; // number of accounts, up to MAX_ACCOUNTS
+    int partitioned; // 1 to split the accounts into one partition per worker, each pinned to a core
+    int queue_capacity; // maximum number of queued requests, 0 for unbounded
+    int queue_policy; // one of the POLICY_* values
+};
+
+// Called for every completed request
+//  - Runs on a worker thread, except for a REJECT given at submit time (bad_account, queue_full under POLICY_REJECT or shed under
+//    POLICY_SHED), which runs on the thread calling bank_submit or bank_submit_batch
+//  - Must not call bank_submit or bank_submit_batch under POLICY_BLOCK - with the queue full, the worker running
+//    the callback waits for room that only the workers can make, and can deadlock
+typedef void (*bank_callback)(const struct bank_result* result, void* arg);
+
+// Engine lifetime
+int bank_init(const struct bank_config* config, bank_callback callback, void* arg);
+void bank_drain();
+void bank_shutdown();
+
+// Building and submitting requests
+struct request* bank_new_check(int acc_id);
+struct request* bank_new_trans(int num_trans);
+struct request* bank_new_audit();
+struct request* bank_new_sum(int lo, int hi);
+struct request* bank_new_batch(int num_reqs);
+int bank_batch_add(struct request* batch, struct request* req);
+void bank_set_deadline(struct request* req, int timeout_ms);
+void bank_free_request(struct request* req);
+void bank_submit(struct request* req);
+void bank_submit_batch(struct request* reqs[], int numReqs);
+
+// Results and stats
+int bank_poll(struct bank_result results[], int max, int wait);
+void bank_get_stats(struct bank_stats* stats);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_MAGIC "BANKTRC1"
+
+// Declare functions
+int readVarint(FILE* trace, unsigned long long* value);
+void addNanoseconds(struct timespec* time, long long ns);
+
+/* Replays a trace captured by appserver -trace onto stdout
+ *  - Pipe the output into appserver to feed it the recorded lines with the recorded timing
+ *
+ * Inputs:
+ *    Arg 1 -- Trace file name
+ *    Arg 2 -- Speed: 1 for the recorded timing, N for N times faster, max for no delays - Default is 1
+*/
+int main(int argc, char *argv[]) {
+    // Check the arguments
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace file> [speed|max]\n", argv[0]);
+        exit(1);
+    }
+
+    // Get the speed - 0 means as fast as possible
+    double speed = 1;
+    if (argc > 2) {
+        speed = !strcmp(argv[2], "max") ? 0 : atof(argv[2]);
+        if (speed < 0) {
+            fprintf(stderr, "Speed must be positive or max\n");
+            exit(1);
+        }
+    }
+
+    // Open the trace and check that it is one
+    FILE* trace = fopen(argv[1], "rb");
+    if (trace == NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        exit(1);
+    }
+    char magic[sizeof(TRACE_MAGIC)] = "";
+    if (fread(magic, 1, strlen(TRACE_MAGIC), trace) != strlen(TRACE_MAGIC) || strcmp(magic, TRACE_MAGIC)) {
+        fprintf(stderr, "%s is not an appserver trace\n", argv[1]);
+        exit(1);
+    }
+
+    // Recorded times are relative to when replay starts
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    // Buffer for the longest line seen so far
+    char* line = NULL;
+    unsigned long long lineCap = 0;
+
+    while (1) {
+        // Read the record header - the end of the file ends the replay
+        unsigned long long delta, len;
+        if (!readVarint(trace, &delta) || !readVarint(trace, &len)) {
+            break;
+        }
+
+        // Read the line
+        if (len + 1 > lineCap) {
+            lineCap = len + 1;
+            line = (char*) realloc(line, lineCap);
+        }
+        if (fread(line, 1, len, trace) != len) {
+            fprintf(stderr, "Trace is truncated\n");
+            exit(1);
+        }
+        line[len] = '\n';
+
+        // Wait until the scaled arrival time, flushing first so the earlier lines are not held back
+        if (speed > 0 && delta > 0) {
+            addNanoseconds(&next, (long long) (delta / speed));
+            fflush(stdout);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0);
+        }
+
+        // Write the line
+        fwrite(line, 1, len + 1, stdout);
+    }
+
+    // Clean up
+    fflush(stdout);
+    free(line);
+    fclose(trace);
+    return 0;
+}
+
+/* Reads a varint written by appserver, 7 bits per byte, low bits first
+ * Inputs:
+ *    trace -- The trace file
+ *    value -- Set to the value read
+ *
+ * Outputs:
+ *    int -- 1 if a value was read; 0 at the end of the file
+*/
+int readVarint(FILE* trace, unsigned long long* value) {
+    *value = 0;
+    int shift = 0, c;
+    while ((c = fgetc(trace)) != EOF) {
+        *value |= (unsigned long long) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+/* Adds nanoseconds to a timespec
+ * Inputs:
+ *    time -- The time to move forward
+ *    ns -- The nanoseconds to add
+*/
+void addNanoseconds(struct timespec* time, long long ns) {
+    time->tv_sec += ns / 1000000000LL;
+    time->tv_nsec += ns % 1000000000LL;
+    if (time->tv_nsec >= 1000000000L) {
+        time->tv_sec++;
+        time->tv_nsec -= 1000000000L;
+    }
+}